@@ -10,11 +10,46 @@
 #include <img4tool/ASN1DERElement.hpp>
 #include <libgeneral/macros.h>
 #include <string.h>
+#include <atomic>
 
 using namespace tihmstar::img4tool;
 
 #pragma mark helper
 
+static std::atomic<uint64_t> gBufAllocations{0};
+static std::atomic<uint64_t> gBufBytesCopied{0};
+
+/*
+    Storage is always malloc'ed, the deleter remembers how much so operator+= can grow it in place
+ */
+struct storageDeleter{
+    size_t capacity;
+    bool released; //realloc took over the memory
+    void operator()(const void *buf) const {
+        if (!released) free((void*)buf);
+    }
+};
+
+static std::shared_ptr<const void> allocStorage(size_t size){
+    void *buf = NULL;
+    assure(buf = malloc(size));
+    gBufAllocations++;
+    return {buf,storageDeleter{size,false}};
+}
+
+static void countCopy(size_t size){
+    gBufBytesCopied += size;
+}
+
+ASN1DERElement::bufstats ASN1DERElement::getBufStats(){
+    return {gBufAllocations.load(), gBufBytesCopied.load()};
+}
+
+void ASN1DERElement::resetBufStats(){
+    gBufAllocations = 0;
+    gBufBytesCopied = 0;
+}
+
 std::string ASN1DERElement::makeASN1Size(size_t size){
     assure(size < 0x100000000);
     if (size >= 0x1000000) {
@@ -51,16 +86,17 @@ ASN1DERElement ASN1DERElement::makeASN1Integer(uint64_t num){
 
 #pragma mark ASN1DERElementIterator
 
-ASN1DERElement::ASN1DERElementIterator::ASN1DERElementIterator(const ASN1DERElement::ASN1TAG *buf, size_t containerSize, size_t pos) :
+ASN1DERElement::ASN1DERElementIterator::ASN1DERElementIterator(std::shared_ptr<const void> storage, const ASN1DERElement::ASN1TAG *buf, size_t containerSize, size_t pos) :
+    _storage(storage),
     _buf(buf),
-    _containerSize(containerSize),
-    _pos(pos)
+    _pos(pos),
+    _containerSize(containerSize)
 {
     //
 }
 
 ASN1DERElement::ASN1DERElementIterator &ASN1DERElement::ASN1DERElementIterator::operator++(){
-    ASN1DERElement e(_buf+_pos,_containerSize-_pos);
+    ASN1DERElement e(_storage,_buf+_pos,_containerSize-_pos);
     _pos += e.size();
     assure(_pos<=_containerSize);
     return *this;
@@ -71,98 +107,94 @@ bool ASN1DERElement::ASN1DERElementIterator::operator!=(const ASN1DERElementIter
 }
 
 const ASN1DERElement ASN1DERElement::ASN1DERElementIterator::operator*() const{
-    return {_buf+_pos,_containerSize-_pos};
+    return {_storage,_buf+_pos,_containerSize-_pos};
 }
 
 #pragma mark ASN1DERElement
 
 ASN1DERElement::ASN1DERElement() :
     _buf(NULL),
-    _bufSize(0),
-    _ownsBuffer(true)
+    _bufSize(0)
 {
     constexpr const ASN1TAG tag{img4tool::ASN1DERElement::TagNULL,img4tool::ASN1DERElement::Primitive,img4tool::ASN1DERElement::Universal};
     std::string size = makeASN1Size(0);
-    assure(_buf = (const ASN1TAG *)malloc(_bufSize = 1+size.size()));
+    _storage = allocStorage(_bufSize = 1+size.size());
+    _buf = (const ASN1TAG *)_storage.get();
 
     memcpy((void*)&_buf[0], &tag, 1);
     memcpy((void*)&_buf[1], size.c_str(), size.size());
 }
 
 ASN1DERElement::ASN1DERElement(const void *buf, size_t bufSize, bool ownsBuffer) :
-    _buf(NULL),
-    _bufSize(0),
-    _ownsBuffer(true)
+    _buf((const ASN1TAG*)buf),
+    _bufSize(bufSize)
 {
+    //validate before touching the buffer, so the caller keeps ownership if this throws
+    verify();
     if (ownsBuffer) {
-        _buf = (const ASN1TAG*)buf;
-        _bufSize = bufSize;
+        _storage = std::shared_ptr<const void>(buf,storageDeleter{bufSize,false});
     }else{
         //if we don't get the ownershipt of the buffer transfered to us, we have to make a copy!
-        _buf = (ASN1TAG*)malloc(_bufSize = bufSize);
-        memcpy((void*)_buf, buf, _bufSize);
+        _bufSize = size();
+        _storage = allocStorage(_bufSize);
+        memcpy((void*)_storage.get(), buf, _bufSize); countCopy(_bufSize);
+        _buf = (const ASN1TAG*)_storage.get();
     }
+}
 
-    assure(_bufSize >= 2); //needs at least TAG and Size
-    if (((uint8_t*)_buf)[0] != 0xff) {
-        assure(_buf->tagNumber <= TagBMPString);
-    }
-    assure(_bufSize >= size());
+ASN1DERElement::ASN1DERElement(std::shared_ptr<const void> storage, const void *buf, size_t bufSize) :
+    _storage(storage),
+    _buf((const ASN1TAG*)buf),
+    _bufSize(bufSize)
+{
+    verify();
+    //a slice only ever spans its own element
+    _bufSize = size();
 }
 
 ASN1DERElement::ASN1DERElement(const ASN1TAG tag, const void *payload, size_t payloadLen) :
     _buf(NULL),
-    _bufSize(0),
-    _ownsBuffer(true)
+    _bufSize(0)
 {
     std::string size = makeASN1Size(payloadLen);
-    assure(_buf = (const ASN1TAG *)malloc(_bufSize = 1+payloadLen+size.size()));
+    _storage = allocStorage(_bufSize = 1+payloadLen+size.size());
+    _buf = (const ASN1TAG *)_storage.get();
 
     memcpy((void*)&_buf[0], &tag, 1);
     memcpy((void*)&_buf[1], size.c_str(), size.size());
     if (payloadLen) {
-        memcpy((void*)&_buf[1+size.size()], payload, payloadLen);
+        memcpy((void*)&_buf[1+size.size()], payload, payloadLen); countCopy(payloadLen);
     }
 }
 
-ASN1DERElement::ASN1DERElement(ASN1DERElement &&old){
-    void *buf = NULL;
-    cleanup([&]{
-        safeFree(buf);
-    });
-    if (_ownsBuffer){
-        buf = (void*)_buf; _buf = NULL;
-    }
-    if (old._ownsBuffer) {
-        _buf = old._buf;
-        _bufSize = old._bufSize;
-        _ownsBuffer = old._ownsBuffer; old._ownsBuffer = false;
-    }else{
-        /*
-         if the old object doesn't own the buffer, we have to perform a copy!
-         Otherwise there is no guarantee that the buffer will stay valid
-         */
-        _bufSize = old._bufSize;
-        _ownsBuffer = true;
-        _buf = (ASN1TAG*)malloc(_bufSize);
-        memcpy((void*)&_buf[0], old._buf, _bufSize);
-    }
+ASN1DERElement::ASN1DERElement(ASN1DERElement &&old) :
+    _storage(std::move(old._storage)),
+    _buf(old._buf),
+    _bufSize(old._bufSize)
+{
+    old._buf = NULL;
+    old._bufSize = 0;
 }
 
 ASN1DERElement::ASN1DERElement(const ASN1DERElement &old) :
-    _buf(NULL),
-    _bufSize(old._bufSize),
-    _ownsBuffer(true)
+    _storage(old._storage),
+    _buf(old._buf),
+    _bufSize(old._bufSize)
 {
-    _buf = (ASN1TAG*)malloc(_bufSize);
-    memcpy((void*)&_buf[0], old._buf, _bufSize);
+    //
 }
 
 
 ASN1DERElement::~ASN1DERElement(){
-    if (_ownsBuffer) {
-        safeFreeConst(_buf);
+    //
+}
+
+void ASN1DERElement::verify() const{
+    assure(_bufSize >= 2); //needs at least TAG and Size
+    if (((uint8_t*)_buf)[0] != 0xff) {
+        assure(_buf->tagNumber <= TagBMPString);
     }
+    assure(_bufSize >= size());
 }
 
 size_t ASN1DERElement::taginfoSize() const{
@@ -208,7 +240,7 @@ size_t ASN1DERElement::size() const{
 }
 
 bool ASN1DERElement::ownsBuffer() const{
-   return _ownsBuffer;
+   return (bool)_storage;
 }
 
 
@@ -216,6 +248,17 @@ const void *ASN1DERElement::buf() const{
     return _buf;
 }
 
+void *ASN1DERElement::mutableBuf(){
+    if (_storage.use_count() > 1) {
+        //someone else is looking at this memory, detach before handing out write access
+        std::shared_ptr<const void> storage = allocStorage(_bufSize);
+        memcpy((void*)storage.get(), _buf, _bufSize); countCopy(_bufSize);
+        _storage = storage;
+        _buf = (const ASN1TAG*)_storage.get();
+    }
+    return (void*)_buf;
+}
+
 const void *ASN1DERElement::payload() const{
     return ((uint8_t*)_buf)+taginfoSize();
 }
@@ -271,94 +314,86 @@ void ASN1DERElement::print() const{
 
 ASN1DERElement ASN1DERElement::operator[](uint32_t i) const{
     assure(_buf->isConstructed);
-    ASN1DERElement rt(payload(),payloadSize());
-    
     size_t bufSize = payloadSize();
     const uint8_t *bufptr = (const uint8_t *)payload();
+    ASN1DERElement rt(_storage, bufptr, bufSize);
+
     while (i--){
         bufptr += rt.size();
         bufSize -= rt.size();
-        rt = ASN1DERElement(bufptr, bufSize);
+        rt = ASN1DERElement(_storage, bufptr, bufSize);
     }
 
     return rt;
 }
 
 ASN1DERElement &ASN1DERElement::operator+=(const ASN1DERElement &add){
-    if (!_ownsBuffer){
-        //make a copy
-        *this = (const ASN1DERElement&)(*this);
-    }
-    assure(_buf->isConstructed && _ownsBuffer);
-
-    std::string newSize = makeASN1Size(add.size()+payloadSize());
-
-    if (newSize.size() < taginfoSize()) {
-        //newSize fits in the buffer without resizing at front
-        _buf = (const ASN1TAG *)realloc((void*)_buf, _bufSize = size() + add.size());
-
-        memcpy((void*)&_buf[size()], add.buf(), add.size());
-        memcpy((void*)&_buf[1], newSize.c_str(), newSize.size());
-    }else{
-        size_t size = add.size() + payloadSize() + 1 + newSize.size();
-        const ASN1TAG *buf = (const ASN1TAG *)malloc(size);
-
-        cleanup([&]{
-            void *b = (void*)buf; buf = NULL;
-            safeFree(b);
-        })
+    assure(_buf->isConstructed);
 
-        memcpy((void*)&buf[0], &_buf[0], 1);
-        memcpy((void*)&buf[1], newSize.c_str(), newSize.size());
-        memcpy((void*)&buf[1+newSize.size()], payload(), payloadSize());
-        memcpy((void*)&buf[1+newSize.size()+payloadSize()], add.buf(), add.size());
+    size_t payloadLen = payloadSize();
+    std::string newSize = makeASN1Size(add.size()+payloadLen);
+    size_t size = add.size() + payloadLen + 1 + newSize.size();
+    storageDeleter *d = std::get_deleter<storageDeleter>(_storage);
+
+    if (d && _storage.use_count() == 1 && (const void*)_buf == _storage.get() && &add != this) {
+        //nobody else looks at this buffer, append in place (growing it geometrically if needed)
+        uint8_t *buf = (uint8_t*)_storage.get();
+        size_t oldTaginfo = taginfoSize();
+        if (d->capacity < size) {
+            size_t capacity = std::max(size, 2*d->capacity);
+            uint8_t *newbuf = NULL;
+            assure(newbuf = (uint8_t*)realloc(buf, capacity));
+            gBufAllocations++;
+            d->released = true;
+            _storage = std::shared_ptr<const void>(newbuf,storageDeleter{capacity,false});
+            buf = newbuf;
+        }
+        if (oldTaginfo != 1+newSize.size()) {
+            memmove(&buf[1+newSize.size()], &buf[oldTaginfo], payloadLen); countCopy(payloadLen);
+        }
+        memcpy(&buf[1], newSize.c_str(), newSize.size());
+        memcpy(&buf[1+newSize.size()+payloadLen], add.buf(), add.size());
+        countCopy(add.size());
 
-        std::swap(_buf, buf);
+        _buf = (const ASN1TAG *)buf;
         _bufSize = size;
+        return *this;
     }
 
+    //the buffer is shared with other elements, build a new one
+    std::shared_ptr<const void> storage = allocStorage(size);
+    uint8_t *buf = (uint8_t*)storage.get();
+
+    memcpy(&buf[0], &_buf[0], 1);
+    memcpy(&buf[1], newSize.c_str(), newSize.size());
+    memcpy(&buf[1+newSize.size()], payload(), payloadLen);
+    memcpy(&buf[1+newSize.size()+payloadLen], add.buf(), add.size());
+    countCopy(payloadLen + add.size());
+
+    _storage = storage;
+    _buf = (const ASN1TAG *)buf;
+    _bufSize = size;
     return *this;
 }
 
 ASN1DERElement &ASN1DERElement::operator=(ASN1DERElement &&old){
-    void *buf = NULL;
-    cleanup([&]{
-        safeFree(buf);
-    });
-    if (_ownsBuffer){
-        buf = (void*)_buf; _buf = NULL;
-    }
-    if (old._ownsBuffer) {
-        _buf = old._buf;
-        _bufSize = old._bufSize;
-        _ownsBuffer = old._ownsBuffer; old._ownsBuffer = false;
-    }else{
-        /*
-         if the old object doesn't own the buffer, we have to perform a copy!
-         Otherwise there is no guarantee that the buffer will stay valid
-         */
-        _bufSize = old._bufSize;
-        _ownsBuffer = true;
-        _buf = (ASN1TAG*)malloc(_bufSize);
-        memcpy((void*)&_buf[0], old._buf, _bufSize);
-    }
-
+    _storage = std::move(old._storage);
+    _buf = old._buf; old._buf = NULL;
+    _bufSize = old._bufSize; old._bufSize = 0;
     return *this;
 }
 
 ASN1DERElement &ASN1DERElement::operator=(const ASN1DERElement &old){
+    _storage = old._storage;
+    _buf = old._buf;
     _bufSize = old._bufSize;
-    _ownsBuffer = true;
-    _buf = (ASN1TAG*)malloc(_bufSize);
-    memcpy((void*)&_buf[0], old._buf, _bufSize);
-
     return *this;
 }
 
 ASN1DERElement::ASN1DERElementIterator ASN1DERElement::begin() const{
-    return {(const ASN1TAG *)payload(),payloadSize(),0};
+    return {_storage,(const ASN1TAG *)payload(),payloadSize(),0};
 }
 
 ASN1DERElement::ASN1DERElementIterator ASN1DERElement::end() const{
-    return {(const ASN1TAG *)payload(),payloadSize(),payloadSize()};
+    return {_storage,(const ASN1TAG *)payload(),payloadSize(),payloadSize()};
 }
@@ -0,0 +1,175 @@
+//
+//  ASN1DERNode.cpp
+//  img4tool
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include <img4tool/ASN1DERNode.hpp>
+#include <libgeneral/macros.h>
+#include <string.h>
+
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#elif defined(HAVE_WINSOCK_H)
+#include <winsock.h>
+#endif
+
+using namespace tihmstar::img4tool;
+
+#pragma mark ASN1DERNode
+
+ASN1DERNode::ASN1DERNode(const void *buf, size_t bufSize) :
+    _buf((const uint8_t *)buf),
+    _taginfoSize(0),
+    _payloadSize(0),
+    _privTag(0)
+{
+    size_t privTagBytes = 0;
+    const ASN1DERElement::ASN1Len *tlen = NULL;
+    assure(bufSize >= 2); //needs at least TAG and Size
+
+    if (_buf[0] == ASN1DERElement::TagPrivate) {
+        const ASN1DERElement::ASN1PrivateTag *ptag = (const ASN1DERElement::ASN1PrivateTag *)&_buf[1];
+        uint32_t privTag = 0;
+        do {
+            assure(bufSize >= 2 + (++privTagBytes));
+            privTag <<= 7;
+            privTag |= ptag->num;
+        } while (ptag++->more);
+        _privTag = htonl(privTag);
+    }else{
+        assure(((ASN1DERElement::ASN1TAG*)_buf)->tagNumber <= ASN1DERElement::TagBMPString);
+    }
+
+    tlen = (const ASN1DERElement::ASN1Len *)&_buf[1+privTagBytes];
+    if (!tlen->isLong) {
+        _taginfoSize = 2 + privTagBytes;
+        _payloadSize = tlen->len;
+    }else{
+        _taginfoSize = 2 + privTagBytes + tlen->len;
+        assure(tlen->len <= sizeof(size_t)); //can't hold more than size_t
+        assure(bufSize >= _taginfoSize); //len bytes shouldn't be outside of buffer
+        for (uint8_t sizebits = 0; sizebits < tlen->len; sizebits++) {
+            _payloadSize <<= 8;
+            _payloadSize |= _buf[2+privTagBytes+sizebits];
+        }
+    }
+    assure(_payloadSize <= bufSize - _taginfoSize);
+}
+
+ASN1DERNode::ASN1DERNode(const ASN1DERElement &elem)
+: ASN1DERNode(elem.buf(), elem.size())
+{
+    //
+}
+
+const std::vector<ASN1DERNode> &ASN1DERNode::children() const{
+    if (!_children) {
+        //private tags wrap exactly one element, which we treat as their child
+        assure(isPrivate() || tag().isConstructed);
+        auto children = std::make_shared<std::vector<ASN1DERNode>>();
+        const uint8_t *payload = _buf + _taginfoSize;
+        for (size_t pos = 0; pos < _payloadSize;) {
+            children->push_back({payload + pos, _payloadSize - pos});
+            pos += children->back().size();
+        }
+        _children = children;
+    }
+    return *_children;
+}
+
+ASN1DERElement::ASN1TAG ASN1DERNode::tag() const{
+    return *(ASN1DERElement::ASN1TAG*)_buf;
+}
+
+bool ASN1DERNode::isPrivate() const{
+    return _buf[0] == ASN1DERElement::TagPrivate;
+}
+
+uint32_t ASN1DERNode::privTag() const{
+    return _privTag;
+}
+
+const void *ASN1DERNode::buf() const{
+    return _buf;
+}
+
+const void *ASN1DERNode::payload() const{
+    return _buf + _taginfoSize;
+}
+
+size_t ASN1DERNode::taginfoSize() const{
+    return _taginfoSize;
+}
+
+size_t ASN1DERNode::payloadSize() const{
+    return _payloadSize;
+}
+
+size_t ASN1DERNode::size() const{
+    return _taginfoSize + _payloadSize;
+}
+
+std::string ASN1DERNode::getStringValue() const{
+    assure(!isPrivate());
+    assure(tag().tagNumber == ASN1DERElement::TagIA5String || tag().tagNumber == ASN1DERElement::TagOCTET || tag().tagNumber == ASN1DERElement::TagUTF8String);
+    return {(const char*)payload(),_payloadSize};
+}
+
+uint64_t ASN1DERNode::getIntegerValue() const{
+    uint64_t rt = 0;
+    assure(tag().tagNumber == ASN1DERElement::TagINTEGER || tag().tagNumber == ASN1DERElement::TagBOOLEAN);
+    assure(_payloadSize <= sizeof(uint64_t));
+    for (uint8_t sizebits = 0; sizebits < _payloadSize; sizebits++) {
+        rt <<= 8;
+        rt |= ((const uint8_t*)payload())[sizebits];
+    }
+    return rt;
+}
+
+size_t ASN1DERNode::childCount() const{
+    return children().size();
+}
+
+const ASN1DERNode &ASN1DERNode::operator[](size_t i) const{
+    auto &c = children();
+    retassure(i < c.size(), "child index %zu out of range (have %zu)",i,c.size());
+    return c[i];
+}
+
+const std::unordered_map<uint32_t, size_t> &ASN1DERNode::privTagIndex() const{
+    if (!_privTagIndex) {
+        auto index = std::make_shared<std::unordered_map<uint32_t, size_t>>();
+        auto &c = children();
+        for (size_t i = 0; i < c.size(); i++) {
+            if (c[i].isPrivate()) index->insert({c[i].privTag(), i});
+        }
+        _privTagIndex = index;
+    }
+    return *_privTagIndex;
+}
+
+const ASN1DERNode &ASN1DERNode::privTagContent(uint32_t privTag) const{
+    auto &index = privTagIndex();
+    auto e = index.find(privTag);
+    retassure(e != index.end(), "failed to find private tag '%.4s'",(char*)&privTag);
+    return children()[e->second][0];
+}
+
+bool ASN1DERNode::hasPrivTag(uint32_t privTag) const{
+    auto &index = privTagIndex();
+    return index.find(privTag) != index.end();
+}
+
+std::vector<ASN1DERNode>::const_iterator ASN1DERNode::begin() const{
+    return children().begin();
+}
+
+std::vector<ASN1DERNode>::const_iterator ASN1DERNode::end() const{
+    return children().end();
+}
+
+ASN1DERElement ASN1DERNode::element() const{
+    return {_buf, size()};
+}
@@ -0,0 +1,187 @@
+//
+//  IM4MVerifier.cpp
+//  img4tool
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include <img4tool/IM4MVerifier.hpp>
+#include <img4tool/img4tool.hpp>
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#ifdef HAVE_OPENSSL
+#   include <openssl/sha.h>
+#   include <openssl/x509.h>
+#   include <openssl/x509v3.h>
+#   include <openssl/evp.h>
+#endif //HAVE_OPENSSL
+
+using namespace tihmstar::img4tool;
+
+struct IM4MVerifier::chainentry{
+#ifdef HAVE_OPENSSL
+    EVP_PKEY *pubkey = NULL;
+#endif //HAVE_OPENSSL
+    bool useSHA384 = false;
+
+    ~chainentry(){
+#ifdef HAVE_OPENSSL
+        safeFreeCustom(pubkey, EVP_PKEY_free);
+#endif //HAVE_OPENSSL
+    }
+};
+
+#pragma mark IM4MVerifier
+
+IM4MVerifier::IM4MVerifier(unsigned threads, const void *rootCert, size_t rootCertSize)
+: _threads(threads)
+{
+    if (rootCert) _rootCert.assign((const uint8_t*)rootCert, (const uint8_t*)rootCert+rootCertSize);
+    if (!_threads) _threads = std::max(1U, std::thread::hardware_concurrency());
+}
+
+IM4MVerifier::~IM4MVerifier(){
+    //
+}
+
+std::shared_ptr<IM4MVerifier::chainentry> IM4MVerifier::getChain(const ASN1DERElement &im4m){
+#ifndef HAVE_OPENSSL
+    (void)im4m;
+    reterror("Compiled without openssl");
+#else
+    ASN1DERElement chain = im4m[4];
+    std::string key;
+    key.resize(SHA256_DIGEST_LENGTH);
+    SHA256((const unsigned char*)chain.buf(), chain.size(), (unsigned char*)key.data());
+
+    {
+        std::unique_lock<std::mutex> ul(_cacheLock);
+        auto e = _chainCache.find(key);
+        if (e != _chainCache.end()) return e->second;
+    }
+
+    //parse outside of the lock, if another thread races us for the same chain we keep whichever was first
+    auto entry = std::make_shared<chainentry>();
+    X509 *cert = NULL;
+    X509 *issuer = NULL;
+    X509 *root = NULL;
+    EVP_PKEY *issuerkey = NULL;
+    cleanup([&]{
+        safeFreeCustom(issuerkey, EVP_PKEY_free);
+        safeFreeCustom(root, X509_free);
+        safeFreeCustom(issuer, X509_free);
+        safeFreeCustom(cert, X509_free);
+    });
+    /*
+        Checks that child was issued and signed by parent
+     */
+    auto verifyIssued = [&](X509 *parent, X509 *child){
+        retassure(X509_check_issued(parent, child) == X509_V_OK, "Certificate was not issued by the authority in front of it");
+        safeFreeCustom(issuerkey, EVP_PKEY_free);
+        assure(issuerkey = X509_get_pubkey(parent));
+        retassure(X509_verify(child, issuerkey) == 1, "Certificate signature mismatch");
+    };
+    ASN1DERElement certelem = chain[0];
+    try {
+        //bootAuthority is 0
+        //tssAuthority is 1
+        certelem = chain[1];
+    } catch (tihmstar::exception &e) {
+        //however bootAuthority does not exist on iPhone7
+        entry->useSHA384 = true;
+    }
+    const unsigned char *certificate = (const unsigned char*)certelem.buf();
+    assure(cert = d2i_X509(NULL, &certificate, certelem.size()));
+    if (!entry->useSHA384) {
+        //the tssAuthority has to be signed by the bootAuthority
+        ASN1DERElement issuerelem = chain[0];
+        const unsigned char *issuercert = (const unsigned char*)issuerelem.buf();
+        assure(issuer = d2i_X509(NULL, &issuercert, issuerelem.size()));
+        verifyIssued(issuer, cert);
+    }
+    if (_rootCert.size()) {
+        const unsigned char *rootcert = _rootCert.data();
+        retassure(root = d2i_X509(NULL, &rootcert, _rootCert.size()), "Failed to parse root certificate");
+        verifyIssued(root, issuer ? issuer : cert);
+    }
+    assure(entry->pubkey = X509_get_pubkey(cert));
+
+    std::unique_lock<std::mutex> ul(_cacheLock);
+    return _chainCache.insert({key,entry}).first->second;
+#endif //HAVE_OPENSSL
+}
+
+void IM4MVerifier::verify(const ASN1DERElement &im4m){
+    assure(isIM4M(im4m));
+    ASN1DERElement data = im4m[2];
+    ASN1DERElement sig  = im4m[3];
+
+    /*
+        Certificate signature should be 512
+     */
+    retassure(sig.size() >= 400, "Unkown signing variant");
+#ifndef HAVE_OPENSSL
+    reterror("Compiled without openssl");
+#else
+    EVP_MD_CTX *mdctx = NULL;
+    cleanup([&]{
+        if(mdctx) EVP_MD_CTX_destroy(mdctx);
+    });
+    std::shared_ptr<chainentry> chain = getChain(im4m);
+
+    assure(mdctx = EVP_MD_CTX_create());
+    assure(EVP_DigestVerifyInit(mdctx, NULL, (chain->useSHA384) ? EVP_sha384() : EVP_sha1(), NULL, chain->pubkey) == 1);
+    assure(EVP_DigestVerifyUpdate(mdctx, data.buf(), data.size()) == 1);
+    retassure(EVP_DigestVerifyFinal(mdctx, (const unsigned char*)sig.payload(), sig.payloadSize()) == 1, "Signature mismatch");
+#endif //HAVE_OPENSSL
+}
+
+bool IM4MVerifier::isSignatureValid(const ASN1DERElement &im4m) noexcept{
+    try {
+        verify(im4m);
+        return true;
+    } catch (tihmstar::exception &e) {
+        return false;
+    }
+}
+
+std::vector<IM4MVerifier::result> IM4MVerifier::verify(const std::vector<ASN1DERElement> &im4ms){
+    std::vector<result> ret(im4ms.size(), {false,""});
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next{0};
+    unsigned threads = (unsigned)std::min<size_t>(_threads, im4ms.size());
+
+    auto worker = [&]{
+        for (size_t i; (i = next++) < im4ms.size();) {
+            try {
+                verify(im4ms[i]);
+                ret[i].isValid = true;
+            } catch (tihmstar::exception &e) {
+                ret[i].error = e.what();
+            } catch (std::exception &e) {
+                ret[i].error = e.what();
+            }
+        }
+    };
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : workers) {
+        t.join();
+    }
+    return ret;
+}
+
+size_t IM4MVerifier::cachedChainsCnt() const{
+    std::unique_lock<std::mutex> ul(_cacheLock);
+    return _chainCache.size();
+}
+
+void IM4MVerifier::clearCache(){
+    std::unique_lock<std::mutex> ul(_cacheLock);
+    _chainCache.clear();
+}
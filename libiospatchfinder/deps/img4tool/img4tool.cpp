@@ -11,7 +11,11 @@
 #include <string.h>
 #include <array>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <img4tool/ASN1DERElement.hpp>
+#include <img4tool/ASN1DERNode.hpp>
 #include <libgeneral/macros.h>
 extern "C"{
 #include "lzssdec.h"
@@ -48,6 +52,14 @@ extern "C"{
 #       define SHA384(d, n, md) CC_SHA384(d, n, md)
 #       define SHA_DIGEST_LENGTH CC_SHA1_DIGEST_LENGTH
 #       define SHA384_DIGEST_LENGTH CC_SHA384_DIGEST_LENGTH
+#       define SHA_CTX CC_SHA1_CTX
+#       define SHA1_Init CC_SHA1_Init
+#       define SHA1_Update CC_SHA1_Update
+#       define SHA1_Final CC_SHA1_Final
+#       define SHA512_CTX CC_SHA512_CTX
+#       define SHA384_Init CC_SHA384_Init
+#       define SHA384_Update CC_SHA384_Update
+#       define SHA384_Final CC_SHA384_Final
 #   endif //HAVE_COMMCRYPTO
 #endif // HAVE_OPENSSL
 
@@ -56,6 +68,9 @@ using namespace tihmstar::img4tool;
 
 #define putStr(s,l) printf("%.*s",(int)l,s)
 
+#define IM4P_STREAM_BLOCKSIZE   0x10000 //multiple of the AES blocksize
+#define IM4P_STREAM_CARRYSIZE   0x40    //leftover bytes of a token cut off at the end of a block
+
 namespace tihmstar {
     namespace img4tool {
         void printKBAG(const void *buf, size_t size);
@@ -68,6 +83,15 @@ namespace tihmstar {
         void printRecSequence(const void *buf, size_t size);
 
         ASN1DERElement parsePrivTag(const void *buf, size_t size, size_t *outPrivTag);
+        char *uncompressBufferIfNeeded(const ASN1DERElement &compressedOctet, const ASN1DERElement &origIM4P, size_t *outUnpackedLen, const char **outUsedCompression = NULL, const char **outHypervisor = NULL, size_t *outHypervisorSize = NULL);
+        size_t getBVX2UnpackedSize(const ASN1DERElement &origIM4P);
+        void *streamPayloadFromIM4P(const ASN1DERElement &im4p, size_t *outSize, std::string *outSHA1, std::string *outSHA384, const char *decryptIv, const char *decryptKey, const char **outUsedCompression);
+#ifdef HAVE_CRYPTO
+        void parseDecryptionKeys(const char *decryptIv, const char *decryptKey, uint8_t iv[16], uint8_t key[32]);
+#endif
+#if defined(HAVE_LIBCOMPRESSION) || defined(HAVE_LIBLZFSE)
+        size_t lzfseEncodeChunked(uint8_t *dst, size_t dstSize, const uint8_t *src, size_t srcSize, size_t chunkSize, unsigned threads);
+#endif
         ASN1DERElement uncompressIfNeeded(const ASN1DERElement &compressedOctet, const ASN1DERElement &origIM4P, const char **outUsedCompression = NULL, const char **outHypervisor = NULL, size_t *outHypervisorSize = NULL);
     };
 };
@@ -761,7 +785,32 @@ std::string tihmstar::img4tool::getKBAG(const ASN1DERElement &im4p, int kbagNum)
 }
 
 
-ASN1DERElement tihmstar::img4tool::uncompressIfNeeded(const ASN1DERElement &compressedOctet, const ASN1DERElement &origIM4P, const char **outUsedCompression, const char **outHypervisor, size_t *outHypervisorSize){
+size_t tihmstar::img4tool::getBVX2UnpackedSize(const ASN1DERElement &origIM4P){
+    //checking
+    ASN1DERElement compressingSequence = origIM4P[4];
+    if (!compressingSequence.tag().isConstructed
+            && compressingSequence.tag().tagNumber == ASN1DERElement::TagOCTET
+            && compressingSequence.tag().tagClass == ASN1DERElement::TagClass::Universal){
+        compressingSequence = origIM4P[5];
+    }
+
+    ASN1DERElement versionTag = compressingSequence[0];
+    ASN1DERElement sizeTag    = compressingSequence[1];
+
+    assure(versionTag.tag().isConstructed == ASN1DERElement::Primitive);
+    assure(versionTag.tag().tagNumber == ASN1DERElement::TagINTEGER);
+    assure(versionTag.tag().tagClass == ASN1DERElement::Universal);
+    if (versionTag.getIntegerValue() != 1){
+        reterror("unexpected compression number %llu",versionTag.getIntegerValue());
+    }
+    assure(sizeTag.tag().isConstructed == ASN1DERElement::Primitive);
+    assure(sizeTag.tag().tagNumber == ASN1DERElement::TagINTEGER);
+    assure(sizeTag.tag().tagClass == ASN1DERElement::Universal);
+
+    return sizeTag.getIntegerValue();
+}
+
+char *tihmstar::img4tool::uncompressBufferIfNeeded(const ASN1DERElement &compressedOctet, const ASN1DERElement &origIM4P, size_t *outUnpackedLen, const char **outUsedCompression, const char **outHypervisor, size_t *outHypervisorSize){
     const char *payload = (const char *)compressedOctet.payload();
     size_t payloadSize = compressedOctet.payloadSize();
     size_t unpackedLen = 0;
@@ -769,12 +818,10 @@ ASN1DERElement tihmstar::img4tool::uncompressIfNeeded(const ASN1DERElement &comp
     cleanup([&]{
         safeFree(unpacked);
     });
-    ASN1DERElement retVal=compressedOctet;
 
     if (strncmp(payload, "complzss", 8) == 0) {
         printf("Compression detected, uncompressing (%s): ", "complzss");
         if((unpacked = tryLZSS(payload, payloadSize, &unpackedLen, outHypervisor, outHypervisorSize))){
-            retVal = ASN1DERElement({ASN1DERElement::TagNumber::TagOCTET,ASN1DERElement::Primitive, ASN1DERElement::Universal}, unpacked, unpackedLen);
             printf("ok\n");
             if (outHypervisor && outHypervisorSize && *outHypervisorSize) {
                 printf("Detected and extracted hypervisor!\n");
@@ -787,44 +834,40 @@ ASN1DERElement tihmstar::img4tool::uncompressIfNeeded(const ASN1DERElement &comp
         printf("Compression detected, uncompressing (%s): ", "bvx2");
 #if defined(HAVE_LIBCOMPRESSION) || defined(HAVE_LIBLZFSE)
         size_t uncompSizeReal = 0;
-        //checking
-        ASN1DERElement compressingSequence = origIM4P[4];
-        if (!compressingSequence.tag().isConstructed
-                && compressingSequence.tag().tagNumber == ASN1DERElement::TagOCTET
-                && compressingSequence.tag().tagClass == ASN1DERElement::TagClass::Universal){
-            compressingSequence = origIM4P[5];
-        }
-
-        ASN1DERElement versionTag = compressingSequence[0];
-        ASN1DERElement sizeTag    = compressingSequence[1];
-
-        assure(versionTag.tag().isConstructed == ASN1DERElement::Primitive);
-        assure(versionTag.tag().tagNumber == ASN1DERElement::TagINTEGER);
-        assure(versionTag.tag().tagClass == ASN1DERElement::Universal);
-        if (versionTag.getIntegerValue() != 1){
-            reterror("unexpected compression number %llu",versionTag.getIntegerValue());
-        }
-        assure(sizeTag.tag().isConstructed == ASN1DERElement::Primitive);
-        assure(sizeTag.tag().tagNumber == ASN1DERElement::TagINTEGER);
-        assure(sizeTag.tag().tagClass == ASN1DERElement::Universal);
-
-        unpackedLen = sizeTag.getIntegerValue();
+        unpackedLen = getBVX2UnpackedSize(origIM4P);
         unpacked = (char*)malloc(unpackedLen);
 
         
         if ((uncompSizeReal = lzfse_decode_buffer((uint8_t*)unpacked, unpackedLen, (const uint8_t*)compressedOctet.payload(), compressedOctet.payloadSize(), NULL)) == unpackedLen) {
-            retVal = ASN1DERElement({ASN1DERElement::TagNumber::TagOCTET,ASN1DERElement::Primitive, ASN1DERElement::Universal}, unpacked, unpackedLen);
             printf("ok\n");
             if (outUsedCompression) *outUsedCompression = "bvx2";
         }else{
             printf("failed!\n");
+            safeFree(unpacked);
         }
 #else
         reterror("img4tool was build without bvx2 support");
 #endif
     }
 
-    return retVal;
+    if (unpacked) {
+        *outUnpackedLen = unpackedLen;
+    }
+    char *ret = unpacked; unpacked = NULL;
+    return ret;
+}
+
+ASN1DERElement tihmstar::img4tool::uncompressIfNeeded(const ASN1DERElement &compressedOctet, const ASN1DERElement &origIM4P, const char **outUsedCompression, const char **outHypervisor, size_t *outHypervisorSize){
+    size_t unpackedLen = 0;
+    char *unpacked = NULL;
+    cleanup([&]{
+        safeFree(unpacked);
+    });
+
+    if ((unpacked = uncompressBufferIfNeeded(compressedOctet, origIM4P, &unpackedLen, outUsedCompression, outHypervisor, outHypervisorSize))) {
+        return ASN1DERElement({ASN1DERElement::TagNumber::TagOCTET,ASN1DERElement::Primitive, ASN1DERElement::Universal}, unpacked, unpackedLen);
+    }
+    return compressedOctet;
 }
 
 ASN1DERElement tihmstar::img4tool::getPayloadFromIM4P(const ASN1DERElement &im4p, const char *decryptIv, const char *decryptKey, const char **outUsedCompression, ASN1DERElement *outHypervisor){
@@ -854,38 +897,320 @@ ASN1DERElement tihmstar::img4tool::getPayloadFromIM4P(const ASN1DERElement &im4p
     return ret;
 }
 
+void *tihmstar::img4tool::getRawPayloadFromIM4P(const ASN1DERElement &im4p, size_t *outSize, const char *decryptIv, const char *decryptKey, const char **outUsedCompression){
+    return getRawPayloadAndHashesFromIM4P(im4p, outSize, NULL, NULL, decryptIv, decryptKey, outUsedCompression);
+}
+
+void *tihmstar::img4tool::getRawPayloadAndHashesFromIM4P(const ASN1DERElement &im4p, size_t *outSize, std::string *outSHA1, std::string *outSHA384, const char *decryptIv, const char *decryptKey, const char **outUsedCompression){
+    return streamPayloadFromIM4P(im4p, outSize, outSHA1, outSHA384, decryptIv, decryptKey, outUsedCompression);
+}
+
+/*
+    Single pass over the IM4P: the container is hashed, the payload decrypted block by block and each block
+    is fed to the decompressor right away. Neither a decrypted nor a compressed copy of the whole payload is made
+    (except for encrypted bvx2 with liblzfse, which has no streaming interface).
+    If decompression fails, the payload is returned as is, like uncompressBufferIfNeeded does.
+ */
+void *tihmstar::img4tool::streamPayloadFromIM4P(const ASN1DERElement &im4p, size_t *outSize, std::string *outSHA1, std::string *outSHA384, const char *decryptIv, const char *decryptKey, const char **outUsedCompression){
+    enum {
+        kModeRaw,
+        kModeLZSS,
+        kModeLZFSE
+    } mode = kModeRaw;
+    assure(isIM4P(im4p));
+    ASN1DERElement payload = im4p[3];
+    const uint8_t *im4pBuf = (const uint8_t *)im4p.buf();
+    const uint8_t *src = (const uint8_t *)payload.payload();
+    size_t srcSize = payload.payloadSize();
+    size_t srcPos = 0;
+    bool isEncrypted = decryptIv || decryptKey;
+    uint8_t *stage = NULL;
+    const uint8_t *win = NULL;
+    size_t winLen = 0;
+    uint8_t *out = NULL;
+    size_t outLen = 0;
+    size_t outPos = 0;
+    struct lzss_stream lzss = {};
+#ifdef HAVE_CRYPTO
+    SHA_CTX sha1ctx = {};
+    SHA512_CTX sha384ctx = {};
+    uint8_t iv[16] = {};
+    uint8_t key[32] = {};
+#   ifdef HAVE_OPENSSL
+    AES_KEY decKey = {};
+#   elif defined(HAVE_COMMCRYPTO)
+    CCCryptorRef cryptor = NULL;
+#   endif
+#endif //HAVE_CRYPTO
+#if defined(HAVE_LIBCOMPRESSION)
+    compression_stream cstream = {};
+    bool cstreamInited = false;
+    bool cstreamFailed = false;
+#elif defined(HAVE_LIBLZFSE)
+    uint8_t *lzfseBuf = NULL;
+#endif
+    cleanup([&]{
+        safeFree(out);
+        safeFree(stage);
+#if defined(HAVE_CRYPTO) && !defined(HAVE_OPENSSL) && defined(HAVE_COMMCRYPTO)
+        safeFreeCustom(cryptor, CCCryptorRelease);
+#endif
+#if defined(HAVE_LIBCOMPRESSION)
+        if (cstreamInited) compression_stream_destroy(&cstream);
+#elif defined(HAVE_LIBLZFSE)
+        safeFree(lzfseBuf);
+#endif
+    });
+
+#ifdef HAVE_CRYPTO
+    if (outSHA1) SHA1_Init(&sha1ctx);
+    if (outSHA384) SHA384_Init(&sha384ctx);
+    auto hash = [&](const uint8_t *buf, size_t len){
+        if (outSHA1) SHA1_Update(&sha1ctx, buf, len);
+        if (outSHA384) SHA384_Update(&sha384ctx, buf, len);
+    };
+    if (isEncrypted) {
+        parseDecryptionKeys(decryptIv, decryptKey, iv, key);
+#   ifdef HAVE_OPENSSL
+        retassure(!AES_set_decrypt_key(key, sizeof(key)*8, &decKey), "Failed to set decryption key");
+#   elif defined(HAVE_COMMCRYPTO)
+        retassure(CCCryptorCreate(kCCDecrypt, kCCAlgorithmAES, 0, key, sizeof(key), iv, &cryptor) == kCCSuccess, "Failed to set decryption key");
+#   endif
+    }
+#else
+    retassure(!outSHA1 && !outSHA384, "hashes were requested, but img4tool was compiled without crypto backend!");
+    retassure(!isEncrypted, "decryption keys were provided, but img4tool was compiled without crypto backend!");
+    auto hash = [](const uint8_t *, size_t){};
+#endif //HAVE_CRYPTO
+
+#ifdef HAVE_CRYPTO
+    /*
+        Decrypts len bytes at in to dst, continuing the CBC chain of the previous call
+     */
+    auto decrypt = [&](const uint8_t *in, uint8_t *dst, size_t len){
+        size_t fullBlocks = len & ~(size_t)0xf;
+#   ifdef HAVE_OPENSSL
+        AES_cbc_encrypt(in, dst, fullBlocks, &decKey, iv, AES_DECRYPT);
+#   elif defined(HAVE_COMMCRYPTO)
+        size_t moved = 0;
+        retassure(CCCryptorUpdate(cryptor, in, fullBlocks, dst, fullBlocks, &moved) == kCCSuccess && moved == fullBlocks, "Decryption failed!");
+#   endif
+        if (len > fullBlocks) {
+            //trailing partial block, don't read past the payload
+            uint8_t tail[16] = {};
+            memcpy(tail, in+fullBlocks, len-fullBlocks);
+#   ifdef HAVE_OPENSSL
+            AES_cbc_encrypt(tail, tail, sizeof(tail), &decKey, iv, AES_DECRYPT);
+#   elif defined(HAVE_COMMCRYPTO)
+            retassure(CCCryptorUpdate(cryptor, tail, sizeof(tail), tail, sizeof(tail), &moved) == kCCSuccess, "Decryption failed!");
+#   endif
+            memcpy(dst+fullBlocks, tail, len-fullBlocks);
+        }
+    };
+#endif //HAVE_CRYPTO
+
+    /*
+        Hands out the next len bytes of plaintext, hashing the (encrypted) input on the way.
+        Encrypted payloads get decrypted into the stage buffer behind the carry, otherwise the window just grows in place.
+     */
+    auto pull = [&](size_t len){
+        const uint8_t *cur = src + srcPos;
+        hash(cur, len);
+        srcPos += len;
+        if (!isEncrypted) {
+            if (!win) win = cur;
+            winLen += len;
+            return;
+        }
+        if (winLen) memmove(stage, win, winLen);
+        win = stage;
+#ifdef HAVE_CRYPTO
+        decrypt(cur, stage + winLen, len);
+#endif //HAVE_CRYPTO
+        winLen += len;
+    };
+
+    /*
+        Decompression failed, hand out the payload as is instead.
+        The hashes are complete at this point, only encrypted payloads need another decryption pass.
+     */
+    auto rawPayload = [&]{
+        printf("failed!\n");
+        safeFree(out);
+        assure(out = (uint8_t*)malloc(outLen = srcSize));
+        outPos = srcSize;
+        if (!isEncrypted) {
+            memcpy(out, src, srcSize);
+            return;
+        }
+#if !defined(HAVE_LIBCOMPRESSION) && defined(HAVE_LIBLZFSE)
+        if (lzfseBuf) {
+            memcpy(out, lzfseBuf, srcSize);
+            return;
+        }
+#endif
+#ifdef HAVE_CRYPTO
+        parseDecryptionKeys(decryptIv, decryptKey, iv, key);
+#   if !defined(HAVE_OPENSSL) && defined(HAVE_COMMCRYPTO)
+        retassure(CCCryptorReset(cryptor, iv) == kCCSuccess, "Failed to reset decryption");
+#   endif
+        decrypt(src, out, srcSize);
+#endif //HAVE_CRYPTO
+    };
+
+    //bytes in front of the payload only go into the hash
+    hash(im4pBuf, src-im4pBuf);
+
+    if (isEncrypted) {
+        assure(stage = (uint8_t*)malloc(IM4P_STREAM_BLOCKSIZE + IM4P_STREAM_CARRYSIZE));
+    }
+    pull(std::min<size_t>(IM4P_STREAM_BLOCKSIZE, srcSize));
+
+    //the first block tells us what kind of compression we are dealing with
+    if (winLen >= 8 && strncmp((const char*)win, "complzss", 8) == 0) {
+        size_t dataOffset = 0;
+        printf("Compression detected, uncompressing (%s): ", "complzss");
+        if ((dataOffset = lzss_stream_begin(&lzss, (const char*)win, winLen))) {
+            assure(lzss.dst = out = (uint8_t*)malloc(outLen = lzss.dstlen));
+            win += dataOffset;
+            winLen -= dataOffset;
+            mode = kModeLZSS;
+        }else{
+            printf("failed!\n");
+        }
+    } else if (winLen >= 4 && strncmp((const char*)win, "bvx2", 4) == 0) {
+        printf("Compression detected, uncompressing (%s): ", "bvx2");
+        outLen = getBVX2UnpackedSize(im4p);
+        assure(out = (uint8_t*)malloc(outLen));
+#if defined(HAVE_LIBCOMPRESSION)
+        assure(compression_stream_init(&cstream, COMPRESSION_STREAM_DECODE, COMPRESSION_LZFSE) == COMPRESSION_STATUS_OK);
+        cstreamInited = true;
+        cstream.dst_ptr = out;
+        cstream.dst_size = outLen;
+#elif defined(HAVE_LIBLZFSE)
+        //no streaming interface, decode at the end. Unencrypted payloads straight from the IM4P, otherwise collect the plaintext
+        if (isEncrypted) assure(lzfseBuf = (uint8_t*)malloc(srcSize));
+#else
+        reterror("img4tool was build without bvx2 support");
+#endif
+        mode = kModeLZFSE;
+    }
+    if (mode == kModeRaw) {
+        assure(out = (uint8_t*)malloc(outLen = srcSize));
+    }
+
+    for (;;) {
+        bool isLast = srcPos == srcSize;
+        switch (mode) {
+            case kModeRaw:
+                memcpy(out+outPos, win, winLen);
+                outPos += winLen;
+                winLen = 0;
+                break;
+            case kModeLZSS:
+            {
+                size_t used = lzss_stream_decode(&lzss, win, winLen);
+                if (!lzss.srcleft || lzss.dstpos == lzss.dstlen) {
+                    //whatever comes after the compressed data (e.g. a hypervisor) is not part of the output
+                    used = winLen;
+                }
+                win += used;
+                winLen -= used;
+                break;
+            }
+            case kModeLZFSE:
+#if defined(HAVE_LIBCOMPRESSION)
+                if (cstream.dst_size && !cstreamFailed) {
+                    cstream.src_ptr = win;
+                    cstream.src_size = winLen;
+                    cstreamFailed = compression_stream_process(&cstream, isLast ? COMPRESSION_STREAM_FINALIZE : 0) == COMPRESSION_STATUS_ERROR;
+                    win = cstream.src_ptr;
+                    winLen = cstream.src_size;
+                }
+                if (!cstream.dst_size || cstreamFailed) winLen = 0; //output is complete (or broken), ignore the rest
+#elif defined(HAVE_LIBLZFSE)
+                if (lzfseBuf) memcpy(lzfseBuf+outPos, win, winLen);
+                outPos += winLen;
+                winLen = 0;
+#endif
+                break;
+        }
+        if (isLast) break;
+        retassure(winLen <= IM4P_STREAM_CARRYSIZE, "unexpected leftover of %zu bytes while streaming payload",winLen);
+        if (!winLen) win = NULL;
+        pull(std::min<size_t>(IM4P_STREAM_BLOCKSIZE, srcSize-srcPos));
+    }
+
+    //bytes after the payload only go into the hash
+    hash(src+srcSize, im4pBuf+im4p.size()-(src+srcSize));
+    if (isEncrypted) info("payload decrypted");
+
+    switch (mode) {
+        case kModeRaw:
+            break;
+        case kModeLZSS:
+            if (!lzss_stream_finish(&lzss)) {
+                rawPayload();
+                break;
+            }
+            printf("ok\n");
+            outPos = lzss.dstpos;
+            if (outUsedCompression) *outUsedCompression = "complzss";
+            break;
+        case kModeLZFSE:
+        {
+#if defined(HAVE_LIBCOMPRESSION)
+            bool decoded = !cstreamFailed && !cstream.dst_size;
+#elif defined(HAVE_LIBLZFSE)
+            bool decoded = lzfse_decode_buffer(out, outLen, lzfseBuf ? lzfseBuf : src, outPos, NULL) == outLen;
+#else
+            bool decoded = false;
+#endif
+            if (!decoded) {
+                rawPayload();
+                break;
+            }
+            printf("ok\n");
+            outPos = outLen;
+            if (outUsedCompression) *outUsedCompression = "bvx2";
+            break;
+        }
+    }
+
+#ifdef HAVE_CRYPTO
+    if (outSHA1) {
+        outSHA1->resize(SHA_DIGEST_LENGTH);
+        SHA1_Final((unsigned char *)outSHA1->data(), &sha1ctx);
+    }
+    if (outSHA384) {
+        outSHA384->resize(SHA384_DIGEST_LENGTH);
+        SHA384_Final((unsigned char *)outSHA384->data(), &sha384ctx);
+    }
+#endif //HAVE_CRYPTO
+
+    *outSize = outPos;
+    uint8_t *ret = out; out = NULL;
+    return ret;
+}
+
 ASN1DERElement tihmstar::img4tool::getValFromIM4M(const ASN1DERElement &im4m, uint32_t val){
     assure(isIM4M(im4m));
 
     val = htonl(val); //allows us to pass "ECID" instead of "DICE"
 
-    ASN1DERElement set = im4m[2];
-    ASN1DERElement manbpriv = set[0];
-    size_t privTagVal = 0;
-    ASN1DERElement manb = parsePrivTag(manbpriv.buf(), manbpriv.size(), &privTagVal);
-    assure(privTagVal == *(uint32_t*)"MANB");
+    ASN1DERNode im4mNode(im4m);
+    const ASN1DERNode &manb = im4mNode[2].privTagContent(*(uint32_t*)"MANB");
     assure(manb[0].getStringValue() == "MANB");
 
-    ASN1DERElement manbset = manb[1];
-
-    ASN1DERElement manppriv = manbset[0];
-    ASN1DERElement manp = parsePrivTag(manppriv.buf(), manppriv.size(), &privTagVal);
-    assure(privTagVal == *(uint32_t*)"MANP");
+    const ASN1DERNode &manp = manb[1].privTagContent(*(uint32_t*)"MANP");
     assure(manp[0].getStringValue() == "MANP");
 
-    ASN1DERElement manpset = manp[1];
-
-    for (auto &e : manpset) {
-        size_t ptagVal = 0;
-        ASN1DERElement ptag = parsePrivTag(e.buf(), e.size(), &ptagVal);
-        if (ptagVal == val) {
-            assure(*(uint32_t*)ptag[0].getStringValue().c_str() == val);
-            return ptag[1];
-        }
-    }
+    const ASN1DERNode &manpset = manp[1];
+    retassure(manpset.hasPrivTag(val), "failed to find nonce!");
 
-    reterror("failed to find nonce!");
-    return {0,0};
+    const ASN1DERNode &ptag = manpset.privTagContent(val);
+    assure(*(uint32_t*)ptag[0].getStringValue().c_str() == val);
+    return ptag[1].element();
 }
 
 ASN1DERElement tihmstar::img4tool::genPrivTagForNumberWithPayload(size_t privnum, const ASN1DERElement &payload){
@@ -914,47 +1239,54 @@ ASN1DERElement tihmstar::img4tool::genPrivTagForNumberWithPayload(size_t privnum
     memcpy(&elembuf[i], payloadSize.c_str(), payloadSize.size());
     memcpy(&elembuf[i+payloadSize.size()], payload.buf(), payload.size());
 
-    ASN1DERElement local(elembuf,elemSize);
-
-    //by casting to const we make sure to create a copy which owns the buffer so we can free our local buffer
-    return static_cast<const ASN1DERElement>(local);
+    {
+        //hand elembuf over to the element instead of copying it
+        ASN1DERElement local(elembuf,elemSize,true);
+        elembuf = NULL;
+        return local;
+    }
 }
 
 #pragma mark begin_needs_crypto
 #ifdef HAVE_CRYPTO
-ASN1DERElement tihmstar::img4tool::decryptPayload(const ASN1DERElement &payload, const char *decryptIv, const char *decryptKey){
-    uint8_t iv[16] = {};
-    uint8_t key[32] = {};
+void tihmstar::img4tool::parseDecryptionKeys(const char *decryptIv, const char *decryptKey, uint8_t iv[16], uint8_t key[32]){
     retassure(decryptIv, "decryptPayload requires IV but none was provided!");
     retassure(decryptKey, "decryptPayload requires KEY but none was provided!");
-
-    assure(!payload.tag().isConstructed);
-    assure(payload.tag().tagNumber == ASN1DERElement::TagOCTET);
-    assure(payload.tag().tagClass == ASN1DERElement::TagClass::Universal);
-
-    ASN1DERElement decPayload(payload);
-
-    assure(strlen(decryptIv) == sizeof(iv)*2);
-    assure(strlen(decryptKey) == sizeof(key)*2);
-    for (int i=0; i<sizeof(iv); i++) {
+    assure(strlen(decryptIv) == 16*2);
+    assure(strlen(decryptKey) == 32*2);
+    for (int i=0; i<16; i++) {
         unsigned int t;
         assure(sscanf(decryptIv+i*2,"%02x",&t) == 1);
         iv[i] = t;
     }
-    for (int i=0; i<sizeof(key); i++) {
+    for (int i=0; i<32; i++) {
         unsigned int t;
         assure(sscanf(decryptKey+i*2,"%02x",&t) == 1);
         key[i] = t;
     }
+}
 
+ASN1DERElement tihmstar::img4tool::decryptPayload(const ASN1DERElement &payload, const char *decryptIv, const char *decryptKey){
+    uint8_t iv[16] = {};
+    uint8_t key[32] = {};
+
+    assure(!payload.tag().isConstructed);
+    assure(payload.tag().tagNumber == ASN1DERElement::TagOCTET);
+    assure(payload.tag().tagClass == ASN1DERElement::TagClass::Universal);
+
+    ASN1DERElement decPayload(payload);
+    //decrypting in place, so make sure we don't write to memory shared with the input
+    void *decBuf = (uint8_t*)decPayload.mutableBuf() + decPayload.taginfoSize();
+
+    parseDecryptionKeys(decryptIv, decryptKey, iv, key);
 
 #ifdef HAVE_OPENSSL
     AES_KEY decKey = {};
     retassure(!AES_set_decrypt_key(key, sizeof(key)*8, &decKey), "Failed to set decryption key");
-    AES_cbc_encrypt((const unsigned char*)decPayload.payload(), (unsigned char*)decPayload.payload(), decPayload.payloadSize(), &decKey, iv, AES_DECRYPT);
+    AES_cbc_encrypt((const unsigned char*)decBuf, (unsigned char*)decBuf, decPayload.payloadSize(), &decKey, iv, AES_DECRYPT);
 #else
 #   ifdef HAVE_COMMCRYPTO
-    retassure(CCCrypt(kCCDecrypt, kCCAlgorithmAES, 0, key, sizeof(key), iv, decPayload.payload(), decPayload.payloadSize(), (void*)decPayload.payload(), decPayload.payloadSize(), NULL) == kCCSuccess,
+    retassure(CCCrypt(kCCDecrypt, kCCAlgorithmAES, 0, key, sizeof(key), iv, decBuf, decPayload.payloadSize(), decBuf, decPayload.payloadSize(), NULL) == kCCSuccess,
               "Decryption failed!");
 #   endif //HAVE_COMMCRYPTO
 #endif //HAVE_OPENSSL
@@ -978,45 +1310,24 @@ std::string tihmstar::img4tool::getIM4PSHA384(const ASN1DERElement &im4p){
 
 std::string tihmstar::img4tool::dgstNameForHash(const ASN1DERElement &im4m, std::string hash){
     assure(isIM4M(im4m));
-    ASN1DERElement set = im4m[2];
-    ASN1DERElement manbpriv = set[0];
-    size_t privTagVal = 0;
-    ASN1DERElement manb = parsePrivTag(manbpriv.buf(), manbpriv.size(), &privTagVal);
-    assure(privTagVal == *(uint32_t*)"MANB");
+    ASN1DERNode im4mNode(im4m);
+    const ASN1DERNode &manb = im4mNode[2].privTagContent(*(uint32_t*)"MANB");
     assure(manb[0].getStringValue() == "MANB");
 
-    ASN1DERElement manbset = manb[1];
-
-    for (auto &e : manbset) {
-        size_t pTagVal = 0;
-        ASN1DERElement me = parsePrivTag(e.buf(), e.size(), &pTagVal);
-        if (pTagVal == *(uint32_t*)"MANP")
+    for (auto &e : manb[1]) {
+        if (e.privTag() == *(uint32_t*)"MANP")
             continue;
 
-        ASN1DERElement set = me[1];
-        std::string dgstName = me[0].getStringValue();
+        const ASN1DERNode &me = e[0];
+        const ASN1DERNode &set = me[1];
 
-        for (auto &se : set) {
-            size_t pTagVal = 0;
-            ASN1DERElement sel = parsePrivTag(se.buf(), se.size(), &pTagVal);
-            switch (pTagVal) {
-                case 'TSGD': //DGST
-                {
-                    std::string selDigest = sel[1].getStringValue();
-                    if (selDigest == hash){
-                        return dgstName;
-                    }
-                }
-                    break;
-                default:
-                    break;
-            }
+        if (set.hasPrivTag('TSGD') && set.privTagContent('TSGD')[1].getStringValue() == hash) { //DGST
+            return me[0].getStringValue();
         }
     }
     reterror("Hash not in IM4M");
 }
 
-
 bool tihmstar::img4tool::im4mContainsHash(const ASN1DERElement &im4m, std::string hash) noexcept{
     try {
         dgstNameForHash(im4m,hash);
@@ -1091,7 +1402,62 @@ ASN1DERElement tihmstar::img4tool::getIM4RWithElements(std::map<std::string,std:
     return im4r;
 }
 
-ASN1DERElement tihmstar::img4tool::appendPayloadToIM4P(const ASN1DERElement &im4p, const void *buf, size_t size, const char *compression, const void *buf2Raw, size_t buf2RawSize){
+#if defined(HAVE_LIBCOMPRESSION) || defined(HAVE_LIBLZFSE)
+/*
+    Every chunk gets encoded on its own into a complete LZFSE stream. LZFSE blocks never reference data
+    of a previous block, so dropping the end-of-stream marker of all but the last chunk and concatenating them
+    yields one valid stream which any decoder accepts.
+    Returns 0 if dst is too small.
+ */
+size_t tihmstar::img4tool::lzfseEncodeChunked(uint8_t *dst, size_t dstSize, const uint8_t *src, size_t srcSize, size_t chunkSize, unsigned threads){
+    constexpr const char endOfStream[] = "bvx$";
+    constexpr size_t endOfStreamSize = sizeof(endOfStream)-1;
+    size_t chunksCnt = (srcSize + chunkSize - 1) / chunkSize;
+    std::vector<std::pair<uint8_t *,size_t>> chunks(chunksCnt, {NULL,0});
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextChunk{0};
+    size_t dstPos = 0;
+    cleanup([&]{
+        for (auto &c : chunks) {
+            safeFree(c.first);
+        }
+    });
+
+    if (!threads) threads = std::max(1U, std::thread::hardware_concurrency());
+    if (threads > chunksCnt) threads = (unsigned)chunksCnt;
+
+    auto worker = [&]{
+        for (size_t i; (i = nextChunk++) < chunksCnt;) {
+            size_t chunkStart = i * chunkSize;
+            size_t chunkLen = std::min(chunkSize, srcSize - chunkStart);
+            size_t outSize = chunkLen + 0x100; //room for a raw block plus headers if the chunk doesn't compress
+            uint8_t *out = (uint8_t*)malloc(outSize);
+            if (!out) continue;
+            chunks[i] = {out, lzfse_encode_buffer(out, outSize, &src[chunkStart], chunkLen, NULL)};
+        }
+    };
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < chunksCnt; i++) {
+        size_t chunkOutSize = chunks[i].second;
+        retassure(chunkOutSize > endOfStreamSize, "Failed to compress chunk %zu",i);
+        retassure(!memcmp(&chunks[i].first[chunkOutSize-endOfStreamSize], endOfStream, endOfStreamSize), "Chunk %zu doesn't end with end-of-stream block",i);
+        if (i != chunksCnt-1) chunkOutSize -= endOfStreamSize;
+        if (dstSize - dstPos < chunkOutSize) return 0;
+        memcpy(&dst[dstPos], chunks[i].first, chunkOutSize);
+        dstPos += chunkOutSize;
+    }
+    return dstPos;
+}
+#endif
+
+ASN1DERElement tihmstar::img4tool::appendPayloadToIM4P(const ASN1DERElement &im4p, const void *buf, size_t size, const char *compression, const void *buf2Raw, size_t buf2RawSize, size_t lzfseChunkSize, unsigned lzfseThreads, int lzssLevel){
     assure(im4p.tag().isConstructed);
     assure(im4p.tag().tagNumber == ASN1DERElement::TagSEQUENCE);
     assure(im4p.tag().tagClass == ASN1DERElement::TagClass::Universal);
@@ -1114,8 +1480,8 @@ ASN1DERElement tihmstar::img4tool::appendPayloadToIM4P(const ASN1DERElement &im4
             printf("Compression requested, compressing (%s): ", "complzss");
             packed = (uint8_t *)malloc(packedSize);
             
-            packedSize = lzss_compress((const uint8_t *)buf, (uint32_t)size, packed, (uint32_t)packedSize);
-            assure(packedSize < size);
+            packedSize = lzss_compress_level((const uint8_t *)buf, (uint32_t)size, packed, (uint32_t)packedSize, lzssLevel);
+            assure(packedSize && packedSize < size);
             
             printf("ok\n");
             
@@ -1138,9 +1504,17 @@ ASN1DERElement tihmstar::img4tool::appendPayloadToIM4P(const ASN1DERElement &im4
                 safeFree(packed);
             });
             size_t packedSize = size;
-            packed = (uint8_t *)malloc(packedSize);
-
-            packedSize = lzfse_encode_buffer(packed, packedSize, (const uint8_t *)buf, size, NULL);
+            
+            if (lzfseChunkSize && lzfseChunkSize < size) {
+                //worst case every chunk ends up as a raw block
+                packedSize = size + (size / lzfseChunkSize + 1) * 0x100;
+                packed = (uint8_t *)malloc(packedSize);
+                packedSize = lzfseEncodeChunked(packed, packedSize, (const uint8_t *)buf, size, lzfseChunkSize, lzfseThreads);
+            }else{
+                packed = (uint8_t *)malloc(packedSize);
+                packedSize = lzfse_encode_buffer(packed, packedSize, (const uint8_t *)buf, size, NULL);
+            }
+            assure(packedSize);
             
             printf("ok\n");
             
@@ -1156,6 +1530,8 @@ ASN1DERElement tihmstar::img4tool::appendPayloadToIM4P(const ASN1DERElement &im4
             bvx2Info += ASN1DERElement::makeASN1Integer(size);
             newim4p += bvx2Info;
 #else
+            (void)lzfseChunkSize;
+            (void)lzfseThreads;
             reterror("img4tool was build without bvx2 support");
 #endif
         }else {
@@ -1285,7 +1661,7 @@ ASN1DERElement tihmstar::img4tool::renameIM4P(const ASN1DERElement &im4p, const
     retassure(strlen(type) == 4, "type has size != 4");
     ASN1DERElement newIm4p(im4p);
 
-    uint8_t *ptr = (uint8_t*)newIm4p.payload();
+    uint8_t *ptr = (uint8_t*)newIm4p.mutableBuf() + newIm4p.taginfoSize();
     size_t size = newIm4p.payloadSize();
     {
         ASN1DERElement e0(ptr,size);
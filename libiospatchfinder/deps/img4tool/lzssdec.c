@@ -16,6 +16,10 @@
 #include <libgeneral/macros.h>
 #include <string.h>
 
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #elif defined(HAVE_WINSOCK_H)
@@ -67,9 +71,11 @@ void *memmem(const void *haystack_start, size_t haystack_len, const void *needle
 }
 #endif
 
-static uint32_t decompress_lzss(uint8_t *dst, const uint8_t *src, uint32_t srclen);
+static const uint8_t *decompress_lzss(struct lzss_stream *s, const uint8_t *src, const uint8_t *srcend);
 static uint8_t *compress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srcLen);
+static uint8_t *compress_lzss_chain(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srcLen, int maxChain);
 static uint32_t lzadler32(const uint8_t *buf, int32_t len);
+static uint32_t lzadler32_update(uint32_t adler, const uint8_t *buf, int32_t len);
 
 
 struct compHeader {
@@ -82,27 +88,59 @@ struct compHeader {
     uint8_t     data[0];
 };
 
-char *tryLZSS(const char *compressed, size_t compressedSize, size_t *outSize, const char **outHypervisor, size_t *outHypervisorSize){
+size_t lzss_stream_begin(struct lzss_stream *s, const char *compressed, size_t headerSize){
     struct compHeader *compHeader = (struct compHeader*)compressed;
-    if (!compHeader) return NULL;
     int sig[2] = { 0xfeedfacf, 0x0100000c };
     int sig2[2] = { 0xfeedface, 0x0000000c };
+    size_t searchSize = 1024;
+    char *feed = NULL;
 
-    char *decomp = malloc (ntohl(compHeader->uncompressedSize));
-    char *feed = memmem(compressed+64, 1024, sig, sizeof(sig));
+    memset(s, 0, sizeof(*s));
+    if (!compHeader || headerSize < sizeof(struct compHeader) + sizeof(sig)) return 0;
+    if (searchSize > headerSize - 64) searchSize = headerSize - 64;
 
-    if (!feed){
-        if (!(feed = memmem(compressed+64, 1024, sig2, sizeof(sig2))))
-            return NULL;
+    if (!(feed = memmem(compressed+64, searchSize, sig, sizeof(sig)))){
+        if (!(feed = memmem(compressed+64, searchSize, sig2, sizeof(sig2))))
+            return 0;
     }
-    
     feed--;
-    int rc = decompress_lzss((void*)decomp, (void*)feed, ntohl(compHeader->compressedSize));
-    if (rc != ntohl(compHeader->uncompressedSize)) {
-        return NULL;
-    }
 
-    if (ntohl(compHeader->adler32) != lzadler32((const uint8_t*)decomp, rc)) {
+    s->dstlen = ntohl(compHeader->uncompressedSize);
+    s->srcleft = ntohl(compHeader->compressedSize);
+    s->expectedAdler32 = ntohl(compHeader->adler32);
+    s->adler32 = 1;
+    s->bit = 8;
+    return feed - compressed;
+}
+
+size_t lzss_stream_decode(struct lzss_stream *s, const uint8_t *src, size_t srclen){
+    const uint8_t *end = NULL;
+    uint32_t oldpos = s->dstpos;
+    if (srclen > s->srcleft) srclen = s->srcleft;
+
+    end = decompress_lzss(s, src, src + srclen);
+    s->adler32 = lzadler32_update(s->adler32, s->dst + oldpos, s->dstpos - oldpos);
+    s->srcleft -= end - src;
+    return end - src;
+}
+
+int lzss_stream_finish(const struct lzss_stream *s){
+    return s->dstpos == s->dstlen && s->adler32 == s->expectedAdler32;
+}
+
+char *tryLZSS(const char *compressed, size_t compressedSize, size_t *outSize, const char **outHypervisor, size_t *outHypervisorSize){
+    struct compHeader *compHeader = (struct compHeader*)compressed;
+    struct lzss_stream s;
+    size_t dataOffset = 0;
+    if (!compHeader) return NULL;
+
+    /* the old code always searched 1024 bytes for the macho header */
+    if (!(dataOffset = lzss_stream_begin(&s, compressed, 64+1024 > compressedSize ? compressedSize : 64+1024))) return NULL;
+    if (!(s.dst = malloc(s.dstlen))) return NULL;
+
+    lzss_stream_decode(&s, (const uint8_t*)compressed+dataOffset, compressedSize-dataOffset);
+    if (!lzss_stream_finish(&s)) {
+        free(s.dst);
         return NULL;
     }
     
@@ -129,12 +167,20 @@ char *tryLZSS(const char *compressed, size_t compressedSize, size_t *outSize, co
         }
     }
     
-    *outSize = rc;
-    return (decomp);
+    *outSize = s.dstpos;
+    return (char*)s.dst;
 }
 
 uint32_t lzss_compress(const uint8_t *src, uint32_t src_len,uint8_t *dst, uint32_t dst_len){
+    return lzss_compress_level(src, src_len, dst, dst_len, LZSS_LEVEL_DEFAULT);
+}
+
+uint32_t lzss_compress_level(const uint8_t *src, uint32_t src_len,uint8_t *dst, uint32_t dst_len, int level){
+    /* max hash chain length to walk per position for levels 1-8, level 9 uses the binary trees */
+    static const int chainForLevel[LZSS_LEVEL_BEST-1] = {1, 2, 4, 8, 16, 32, 128, 1024};
     uint32_t compSize = 0;
+    uint8_t *end = NULL;
+    if (dst_len < sizeof(struct compHeader)) return 0;
     memset(dst, 0, dst_len);
 
     struct compHeader *compHeader = (struct compHeader*)dst;
@@ -148,7 +194,13 @@ uint32_t lzss_compress(const uint8_t *src, uint32_t src_len,uint8_t *dst, uint32
     compHeader->uncompressedSize = ntohl(src_len);
     compHeader->unknown1 = ntohl(1);
     
-    uint8_t *end = compress_lzss(dst, dst_len, src, src_len);
+    if (level < LZSS_LEVEL_FASTEST) level = LZSS_LEVEL_DEFAULT;
+    if (level >= LZSS_LEVEL_BEST) {
+        end = compress_lzss(dst, dst_len, src, src_len);
+    } else {
+        end = compress_lzss_chain(dst, dst_len, src, src_len, chainForLevel[level-1]);
+    }
+    if (!end) return 0;
     compSize = (uint32_t)(end-dst);
     compHeader->compressedSize = ntohl(compSize);
     
@@ -156,31 +208,75 @@ uint32_t lzss_compress(const uint8_t *src, uint32_t src_len,uint8_t *dst, uint32
 }
 
 #define BASE 65521L /* largest prime smaller than 65536 */
-#define NMAX 5000
-#define DO1(buf,i)  {s1 += buf[i]; s2 += s1;}
-#define DO2(buf,i)  DO1(buf,i); DO1(buf,i+1);
-#define DO4(buf,i)  DO2(buf,i); DO2(buf,i+2);
-#define DO8(buf,i)  DO4(buf,i); DO4(buf,i+4);
-#define DO16(buf)   DO8(buf,0); DO8(buf,8);
+#define NMAX 5552   /* largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits */
+#define ADLER_BLOCK 32
 
+/*
+ * Works on blocks of ADLER_BLOCK bytes: within a block s2 grows by
+ * ADLER_BLOCK*s1 plus the position weighted sum of the bytes, s1 by their plain sum.
+ * Both sums are independent per byte, so this vectorizes (explicitly with SSSE3,
+ * by the compiler elsewhere) instead of the serial s1->s2 dependency per byte.
+ */
 static uint32_t lzadler32(const uint8_t *buf, int32_t len)
 {
-    unsigned long s1 = 1; // adler & 0xffff;
-    unsigned long s2 = 0; // (adler >> 16) & 0xffff;
-    int k;
+    return lzadler32_update(1, buf, len);
+}
+
+static uint32_t lzadler32_update(uint32_t adler, const uint8_t *buf, int32_t len)
+{
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = (adler >> 16) & 0xffff;
+    int32_t k;
 
     while (len > 0) {
         k = len < NMAX ? len : NMAX;
         len -= k;
-        while (k >= 16) {
-            DO16(buf);
-            buf += 16;
-            k -= 16;
+#ifdef __SSSE3__
+        if (k >= ADLER_BLOCK) {
+            const __m128i tap1 = _mm_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17);
+            const __m128i tap2 = _mm_setr_epi8(16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1);
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i ones = _mm_set1_epi16(1);
+            int32_t blocks = k / ADLER_BLOCK;
+            __m128i v_ps = _mm_set_epi32(0, 0, 0, s1 * blocks);
+            __m128i v_s2 = _mm_set_epi32(0, 0, 0, s2);
+            __m128i v_s1 = zero;
+            k -= blocks * ADLER_BLOCK;
+            do {
+                __m128i bytes1 = _mm_loadu_si128((const __m128i*)buf);
+                __m128i bytes2 = _mm_loadu_si128((const __m128i*)(buf + 16));
+                v_ps = _mm_add_epi32(v_ps, v_s1);
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+                buf += ADLER_BLOCK;
+            } while (--blocks);
+            v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+            v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1,0,3,2)));
+            v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2,3,0,1)));
+            s1 += _mm_cvtsi128_si32(v_s1);
+            v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1,0,3,2)));
+            v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2,3,0,1)));
+            s2 = _mm_cvtsi128_si32(v_s2);
         }
-        if (k != 0) do {
+#else
+        while (k >= ADLER_BLOCK) {
+            uint32_t bs1 = 0, bs2 = 0;
+            for (int i = 0; i < ADLER_BLOCK; i++) {
+                bs1 += buf[i];
+                bs2 += (ADLER_BLOCK - i) * buf[i];
+            }
+            s2 += ADLER_BLOCK * s1 + bs2;
+            s1 += bs1;
+            buf += ADLER_BLOCK;
+            k -= ADLER_BLOCK;
+        }
+#endif
+        while (k--) {
             s1 += *buf++;
             s2 += s1;
-        } while (--k);
+        }
         s1 %= BASE;
         s2 %= BASE;
     }
@@ -221,46 +317,82 @@ struct encode_state {
 };
 
 
-static uint32_t decompress_lzss(uint8_t *dst, const uint8_t *src, uint32_t srclen)
+/*
+ * Decodes straight into dst instead of going through the ring buffer.
+ * Every match is resolved against the output we already produced, only matches
+ * reaching back before the start of the output hit the (implicit) initial ring
+ * buffer content of spaces. Matches are copied 8 bytes at a time where source
+ * and destination don't overlap within a word, literals are copied 8 at a time
+ * when a whole flag byte says so.
+ */
+/* decodes until src or the output runs out, returns how far into src we got */
+static const uint8_t *decompress_lzss(struct lzss_stream *s, const uint8_t *src, const uint8_t *srcend)
 {
-    /* ring buffer of size N, with extra F-1 bytes to aid string comparison */
-    uint8_t text_buf[N + F - 1];
-    uint8_t *dststart = dst;
-    const uint8_t *srcend = src + srclen;
-    int  i, j, k, r, c;
-    unsigned int flags;
-    
-    dst = dststart;
-    srcend = src + srclen;
-    for (i = 0; i < N - F; i++)
-        text_buf[i] = ' ';
-    r = N - F;
-    flags = 0;
-    for ( ; ; ) {
-        if (((flags >>= 1) & 0x100) == 0) {
-            if (src < srcend) c = *src++; else break;
-            flags = c | 0xFF00;  /* uses higher byte cleverly */
-        }   /* to count eight */
-        if (flags & 1) {
-            if (src < srcend) c = *src++; else break;
-            *dst++ = c;
-            text_buf[r++] = c;
-            r &= (N - 1);
-        } else {
-            if (src < srcend) i = *src++; else break;
-            if (src < srcend) j = *src++; else break;
-            i |= ((j & 0xF0) << 4);
-            j  =  (j & 0x0F) + THRESHOLD;
-            for (k = 0; k <= j; k++) {
-                c = text_buf[(i + k) & (N - 1)];
-                *dst++ = c;
-                text_buf[r++] = c;
-                r &= (N - 1);
+    uint8_t *dststart = s->dst;
+    uint8_t *dst = dststart + s->dstpos;
+    uint8_t *dstend = dststart + s->dstlen;
+    unsigned int flags = s->flags, bit = s->bit;
+    size_t pos, dist;
+    int i, len;
+
+    for (;;) {
+        if (bit == 8) {
+            if (src >= srcend) goto done;
+            flags = *src++;
+            bit = 0;
+            if (flags == 0xFF && srcend - src >= 8 && dstend - dst >= 8) {
+                /* eight literals in a row */
+                memcpy(dst, src, 8);
+                dst += 8;
+                src += 8;
+                bit = 8;
+                continue;
+            }
+        }
+        for (; bit < 8; bit++, flags >>= 1) {
+            if (flags & 1) {
+                if (src >= srcend || dst >= dstend) goto done;
+                *dst++ = *src++;
+                continue;
+            }
+            if (srcend - src < 2 || dst >= dstend) goto done;
+            i   = src[0] | ((src[1] & 0xF0) << 4);
+            len = (src[1] & 0x0F) + THRESHOLD + 1;
+            src += 2;
+
+            /* ring position r is (N - F + pos), so the match is dist bytes behind us. 0 means a full window */
+            pos = dst - dststart;
+            dist = (N - F + pos - i) & (N - 1);
+            if (!dist) dist = N;
+
+            if (dist <= pos && dstend - dst >= F + 8) {
+                const uint8_t *m = dst - dist;
+                if (dist >= 8) {
+                    /* may write up to 7 bytes past the match, these get overwritten later */
+                    for (int k = 0; k < len; k += 8)
+                        memcpy(dst + k, m + k, 8);
+                } else if (dist == 1) {
+                    /* run of a single byte, very common for zero padding */
+                    memset(dst, *m, len);
+                } else {
+                    for (int k = 0; k < len; k++)
+                        dst[k] = m[k];
+                }
+                dst += len;
+            } else {
+                for (int k = 0; k < len; k++, pos++) {
+                    if (dst >= dstend) goto done;
+                    *dst++ = (pos < dist) ? ' ' : dststart[pos - dist];
+                }
             }
         }
     }
-    
-    return (uint32_t)(dst - dststart);
+
+done:
+    s->flags = flags;
+    s->bit = bit;
+    s->dstpos = (uint32_t)(dst - dststart);
+    return src;
 }
 
 /*
@@ -494,3 +626,107 @@ static uint8_t *compress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src,
     free(sp);
     return dst;
 }
+
+/*
+ * Greedy hash chain match finder, a lot faster than the binary trees above
+ * at the cost of some ratio. head[] holds the most recent position for each
+ * 3 byte hash, prev[] links each position in the window to the previous one
+ * with the same hash. Emits the same code units as compress_lzss, only
+ * matches against the initial space filled ring buffer are never used.
+ */
+#define HASH_BITS 14
+#define HASH_SIZE (1 << HASH_BITS)
+#define HASH(p)   (((((uint32_t)(p)[0] << 16) | ((p)[1] << 8) | (p)[2]) * 2654435761U) >> (32 - HASH_BITS))
+
+struct chain_state {
+    int32_t head[HASH_SIZE];
+    int32_t prev[N];
+};
+
+static uint8_t *compress_lzss_chain(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srcLen, int maxChain){
+    struct chain_state *cs;
+    uint8_t code_buf[17], mask;
+    int i, code_buf_ptr;
+    uint8_t *dstend = dst + dstlen;
+    uint32_t pos = 0;
+
+    if (!srcLen) return 0;  /* text of size zero */
+    if (!(cs = (struct chain_state *) malloc(sizeof(*cs)))) return 0;
+    memset(cs->head, 0xff, sizeof(cs->head));
+
+    code_buf[0] = 0;
+    code_buf_ptr = mask = 1;
+
+    while (pos < srcLen) {
+        uint32_t avail = srcLen - pos;
+        int maxlen = avail < F ? avail : F;
+        int match_length = 0;
+        uint32_t match_dist = 0;
+
+        if (avail > THRESHOLD) {
+            int32_t cand = cs->head[HASH(&src[pos])];
+            int chain = maxChain;
+            /* keep F bytes of the ring for the lookahead, just like the tree encoder */
+            while (cand >= 0 && pos - cand <= N - F && chain--) {
+                const uint8_t *a = &src[cand];
+                const uint8_t *b = &src[pos];
+                if (a[match_length] == b[match_length]) {
+                    int l = 0;
+                    while (l < maxlen && a[l] == b[l])
+                        l++;
+                    if (l > match_length) {
+                        match_length = l;
+                        match_dist = pos - cand;
+                        if (l >= maxlen)
+                            break;
+                    }
+                }
+                cand = cs->prev[cand & (N - 1)];
+            }
+        }
+
+        if (match_length <= THRESHOLD) {
+            match_length = 1;  /* Not long enough match.  Send one byte. */
+            code_buf[0] |= mask;  /* 'send one byte' flag */
+            code_buf[code_buf_ptr++] = src[pos];  /* Send uncoded. */
+        } else {
+            /* ring position of the match, as seen by the decoder */
+            int match_position = (N - F + pos - match_dist) & (N - 1);
+            code_buf[code_buf_ptr++] = (uint8_t) match_position;
+            code_buf[code_buf_ptr++] = (uint8_t)
+                ( ((match_position >> 4) & 0xF0)
+                |  (match_length - (THRESHOLD + 1)) );
+        }
+        if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
+            /* Send at most 8 units of code together */
+            if (dstend - dst < code_buf_ptr) {
+                free(cs);
+                return 0;
+            }
+            memcpy(dst, code_buf, code_buf_ptr);
+            dst += code_buf_ptr;
+            code_buf[0] = 0;
+            code_buf_ptr = mask = 1;
+        }
+
+        for (i = 0; i < match_length; i++, pos++) {
+            if (srcLen - pos > THRESHOLD) {
+                uint32_t h = HASH(&src[pos]);
+                cs->prev[pos & (N - 1)] = cs->head[h];
+                cs->head[h] = pos;
+            }
+        }
+    }
+
+    if (code_buf_ptr > 1) {    /* Send remaining code. */
+        if (dstend - dst < code_buf_ptr) {
+            free(cs);
+            return 0;
+        }
+        memcpy(dst, code_buf, code_buf_ptr);
+        dst += code_buf_ptr;
+    }
+
+    free(cs);
+    return dst;
+}
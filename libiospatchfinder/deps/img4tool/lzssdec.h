@@ -9,10 +9,46 @@
 #define lzssdec_h
 
 #include <stdlib.h>
+#include <stdint.h>
 
 char *tryLZSS(const char *compressed, size_t compressedSize, size_t *outSize, const char **outHypervisor, size_t *outHypervisorSize);
 
+#define LZSS_LEVEL_FASTEST  1
+#define LZSS_LEVEL_BEST     9   /* binary tree match finder, slowest but best ratio */
+#define LZSS_LEVEL_DEFAULT  LZSS_LEVEL_BEST
+
+/*
+ Always uses the binary tree match finder (LZSS_LEVEL_DEFAULT).
+ */
 uint32_t lzss_compress(const uint8_t *src, uint32_t src_len,uint8_t *dst, uint32_t dst_len);
+/*
+ Levels 1-8 use a hash chain match finder and walk longer chains with increasing level, trading ratio for speed.
+ Levels below LZSS_LEVEL_FASTEST mean LZSS_LEVEL_DEFAULT. Returns 0 if dst is too small.
+ */
+uint32_t lzss_compress_level(const uint8_t *src, uint32_t src_len,uint8_t *dst, uint32_t dst_len, int level);
+
+/*
+ Incremental decoder, for feeding compressed data as it becomes available (e.g. while decrypting).
+ lzss_stream_begin parses the complzss header from the first headerSize bytes and returns the offset
+ where the compressed data starts (0 if this isn't a complzss stream). Afterwards set dst to a buffer
+ of dstlen (uncompressed size) bytes.
+ lzss_stream_decode returns how many bytes of src were consumed, it stops before a token which is
+ cut off at the end of src. Pass the remaining bytes again together with the next chunk.
+ lzss_stream_finish returns 1 if all output was produced and the checksum matches.
+ */
+struct lzss_stream {
+    uint8_t     *dst;
+    uint32_t    dstlen;
+    uint32_t    dstpos;
+    uint32_t    srcleft;    /* compressed bytes not consumed yet */
+    uint32_t    adler32;    /* over dst[0..dstpos) */
+    uint32_t    expectedAdler32;
+    unsigned    flags;
+    unsigned    bit;
+};
 
+size_t lzss_stream_begin(struct lzss_stream *s, const char *compressed, size_t headerSize);
+size_t lzss_stream_decode(struct lzss_stream *s, const uint8_t *src, size_t srclen);
+int lzss_stream_finish(const struct lzss_stream *s);
 
 #endif /* lzssdec_h */
@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <iostream>
+#include <memory>
 
 namespace tihmstar {
     namespace img4tool {
@@ -85,26 +86,38 @@ namespace tihmstar {
             };
             
             class ASN1DERElementIterator{
+                std::shared_ptr<const void> _storage;
                 const ASN1TAG *_buf;
                 size_t _pos;
                 size_t _containerSize;
             public:
-                ASN1DERElementIterator(const ASN1TAG *buf, size_t containerSize, size_t pos);
+                ASN1DERElementIterator(std::shared_ptr<const void> storage, const ASN1TAG *buf, size_t containerSize, size_t pos);
                 ASN1DERElementIterator &operator++();
                 bool operator!=(const ASN1DERElementIterator &e);
                 const ASN1DERElement operator*() const;
             };
             
+            struct bufstats{
+                uint64_t allocations;
+                uint64_t bytesCopied;
+            };
+            
         private:
-            const ASN1TAG *_buf;
-            size_t _bufSize;
             /*
-                If we get a buffer and a size, we never claim ownership, however
-                if we construct an object ourselve we alloc a buffer and thus claim ownership
+                Immutable backing buffer, shared between all elements sliced out of it (sub-elements, copies).
+                Nothing writes to it, unless we are the only one referencing it (see mutableBuf()).
              */
-            bool _ownsBuffer;
+            std::shared_ptr<const void> _storage;
+            const ASN1TAG *_buf;
+            size_t _bufSize;
+            
+            ASN1DERElement(std::shared_ptr<const void> storage, const void *buf, size_t bufSize);
+            void verify() const;
         public:
             ASN1DERElement();
+            /*
+                Without ownsBuffer the element gets copied, otherwise the buffer is adopted and will be free()'d
+             */
             ASN1DERElement(const void *buf, size_t bufSize, bool ownsBuffer = false);
             ASN1DERElement(const ASN1TAG tag, const void *payload, size_t payloadLen);
             ~ASN1DERElement();
@@ -115,6 +128,7 @@ namespace tihmstar {
 
             bool ownsBuffer() const;
             const void *buf() const;
+            void *mutableBuf(); //copies the element if the buffer is shared
             const void *payload() const;
             size_t taginfoSize() const;
             size_t payloadSize() const;
@@ -137,6 +151,9 @@ namespace tihmstar {
             
             static std::string makeASN1Size(size_t size);
             static ASN1DERElement makeASN1Integer(uint64_t num);
+            
+            static bufstats getBufStats();
+            static void resetBufStats();
         };
         
     };
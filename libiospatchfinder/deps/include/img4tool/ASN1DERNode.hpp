@@ -0,0 +1,70 @@
+//
+//  ASN1DERNode.hpp
+//  img4tool
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef ASN1DERNode_hpp
+#define ASN1DERNode_hpp
+
+#include <img4tool/ASN1DERElement.hpp>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+namespace tihmstar {
+    namespace img4tool {
+        /*
+            Read-only, zero-copy view of a DER element and its children.
+            Tag and lengths are decoded once on construction, children are parsed into an offset table
+            on first access and private tags (e.g. 'MANB') get indexed on first lookup.
+            The view does not own the memory, the underlying buffer needs to outlive all nodes.
+         */
+        class ASN1DERNode {
+            const uint8_t *_buf;
+            size_t _taginfoSize;
+            size_t _payloadSize;
+            uint32_t _privTag; //same encoding as parsePrivTag's outPrivTag, 0 if this is not a private tag
+            mutable std::shared_ptr<std::vector<ASN1DERNode>> _children;
+            mutable std::shared_ptr<std::unordered_map<uint32_t, size_t>> _privTagIndex;
+
+            const std::vector<ASN1DERNode> &children() const;
+            const std::unordered_map<uint32_t, size_t> &privTagIndex() const;
+
+        public:
+            ASN1DERNode(const void *buf, size_t bufSize);
+            ASN1DERNode(const ASN1DERElement &elem);
+
+            ASN1DERElement::ASN1TAG tag() const;
+            bool isPrivate() const;
+            uint32_t privTag() const;
+
+            const void *buf() const;
+            const void *payload() const;
+            size_t taginfoSize() const;
+            size_t payloadSize() const;
+            size_t size() const;
+
+            std::string getStringValue() const;
+            uint64_t getIntegerValue() const;
+
+            size_t childCount() const;
+            const ASN1DERNode &operator[](size_t i) const;
+            /*
+                Finds the child private tag with the given 4CC and returns its content (what parsePrivTag would return).
+                Pass the tag as *(uint32_t*)"MANB" or 'BNAM'
+             */
+            const ASN1DERNode &privTagContent(uint32_t privTag) const;
+            bool hasPrivTag(uint32_t privTag) const;
+
+            std::vector<ASN1DERNode>::const_iterator begin() const;
+            std::vector<ASN1DERNode>::const_iterator end() const;
+
+            //makes a copy
+            ASN1DERElement element() const;
+        };
+    };
+};
+
+#endif /* ASN1DERNode_hpp */
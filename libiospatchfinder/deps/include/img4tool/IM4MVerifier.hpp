@@ -0,0 +1,68 @@
+//
+//  IM4MVerifier.hpp
+//  img4tool
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef IM4MVerifier_hpp
+#define IM4MVerifier_hpp
+
+#include <img4tool/ASN1DERElement.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tihmstar {
+    namespace img4tool {
+        /*
+            Verifies IM4M signatures like isIM4MSignatureValid, but remembers the parsed signing key of every
+            certificate chain it has seen (keyed by the hash of the chain), so blobs signed by the same chain
+            only pay for certificate parsing once. Safe to use from multiple threads.
+            A chain is only cached once the signing certificate checked out against the authority in front of it
+            (and against the trusted root, if one was given).
+         */
+        class IM4MVerifier {
+        public:
+            struct result{
+                bool isValid;
+                std::string error; //empty if valid
+            };
+
+        private:
+            struct chainentry;
+            unsigned _threads;
+            std::vector<uint8_t> _rootCert; //DER, empty if there is none
+            mutable std::mutex _cacheLock;
+            std::unordered_map<std::string, std::shared_ptr<chainentry>> _chainCache;
+
+            std::shared_ptr<chainentry> getChain(const ASN1DERElement &im4m);
+
+        public:
+            /*
+                threads == 0 uses one thread per core
+                rootCert (DER) is the certificate the top of every chain has to be issued by, e.g. Apple's root CA
+             */
+            IM4MVerifier(unsigned threads = 0, const void *rootCert = NULL, size_t rootCertSize = 0);
+            ~IM4MVerifier();
+
+            /*
+                Throws if the signature is not valid
+             */
+            void verify(const ASN1DERElement &im4m);
+            bool isSignatureValid(const ASN1DERElement &im4m) noexcept;
+
+            /*
+                Verifies all blobs in parallel, results are in the same order as the input
+             */
+            std::vector<result> verify(const std::vector<ASN1DERElement> &im4ms);
+
+            size_t cachedChainsCnt() const;
+            void clearCache();
+        };
+    };
+};
+
+#endif /* IM4MVerifier_hpp */
@@ -47,6 +47,16 @@ namespace tihmstar {
         std::string getKBAG(const ASN1DERElement &im4p, int kbagNum);
     
         ASN1DERElement getPayloadFromIM4P(const ASN1DERElement &im4p, const char *decryptIv = NULL, const char *decryptKey = NULL, const char **outUsedCompression = NULL, ASN1DERElement *outHypervisor = NULL);
+        /*
+            Like getPayloadFromIM4P, but the payload is decompressed directly into a malloc'd buffer which is returned to the caller.
+            The caller takes ownership and must free() it. Unlike getPayloadFromIM4P no ASN1DERElement copy of the payload is made.
+         */
+        void *getRawPayloadFromIM4P(const ASN1DERElement &im4p, size_t *outSize, const char *decryptIv = NULL, const char *decryptKey = NULL, const char **outUsedCompression = NULL);
+        /*
+            Like getRawPayloadFromIM4P, but also computes getIM4PSHA1/getIM4PSHA384 of the IM4P while streaming over it.
+            The payload is decrypted in blocks which go straight into the decompressor, pass NULL for hashes you don't need.
+         */
+        void *getRawPayloadAndHashesFromIM4P(const ASN1DERElement &im4p, size_t *outSize, std::string *outSHA1, std::string *outSHA384, const char *decryptIv = NULL, const char *decryptKey = NULL, const char **outUsedCompression = NULL);
         ASN1DERElement getValFromIM4M(const ASN1DERElement &im4m, uint32_t val);
 
         ASN1DERElement genPrivTagForNumberWithPayload(size_t privnum, const ASN1DERElement &payload);
@@ -63,7 +73,12 @@ namespace tihmstar {
         ASN1DERElement getEmptyIM4PContainer(const char *type, const char *desc);
         ASN1DERElement getIM4RWithElements(std::map<std::string,std::vector<uint8_t>> elements);
 
-        ASN1DERElement appendPayloadToIM4P(const ASN1DERElement &im4p, const void *buf, size_t size, const char *compression = NULL, const void *buf2Raw = NULL, size_t buf2RawSize = 0);
+        /*
+            With compression "bvx2" and lzfseChunkSize set, the payload is split into chunks of that size which are
+            compressed concurrently on lzfseThreads threads (0 means one per core) and joined into a single LZFSE stream.
+            With compression "complzss", lzssLevel is passed to lzss_compress_level (0 means the default, the binary tree match finder).
+         */
+        ASN1DERElement appendPayloadToIM4P(const ASN1DERElement &im4p, const void *buf, size_t size, const char *compression = NULL, const void *buf2Raw = NULL, size_t buf2RawSize = 0, size_t lzfseChunkSize = 0, unsigned lzfseThreads = 0, int lzssLevel = 0);
 
         bool isIMG4(const ASN1DERElement &img4) noexcept;
         bool isIM4P(const ASN1DERElement &im4p) noexcept;
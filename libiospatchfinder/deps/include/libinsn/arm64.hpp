@@ -85,21 +85,39 @@ namespace tihmstar{
                     LE = 0b1101,
                     AL = 0b1110
                 };
+                /*
+                    o0:op1:CRn:CRm:op2 as encoded in mrs/msr (op0 is always 2 or 3 there).
+                    Registers without a name can be built with sysreg_encode.
+                 */
                 enum systemreg : uint64_t{
                     currentel   = 0x4212,
+                    daif        = 0x5a11,
+                    elr_el1     = 0x4201,
+                    esr_el1     = 0x4290,
+                    far_el1     = 0x4300,
+                    mair_el1    = 0x4510,
+                    midr_el1    = 0x4000,
+                    mpidr_el1   = 0x4005,
+                    tpidr_el0   = 0x5e82,
+                    tpidrro_el0 = 0x5e83,
                     tpidr_el1   = 0x4684,
                     tpidr_el3   = 0x7684,
                     sctlr_el1   = 0x4080,
                     sctlr_el3   = 0x7080,
                     sp_el0      = 0x4208,
                     sp_el1      = 0x6208,
+                    spsr_el1    = 0x4200,
                     tcr_el1     = 0x4102,
                     tcr_el3     = 0x7102,
                     ttbr0_el1   = 0x4100,
                     ttbr0_el3   = 0x7100,
                     ttbr1_el1   = 0x4101,
                     ttbr1_el3   = 0x7101,
+                    vbar_el1    = 0x4600,
                 };
+                static constexpr systemreg sysreg_encode(uint8_t op0, uint8_t op1, uint8_t crn, uint8_t crm, uint8_t op2){
+                    return (systemreg)(((op0 & 1) << 14) | ((op1 & 7) << 11) | ((crn & 0xf) << 7) | ((crm & 0xf) << 3) | (op2 & 7));
+                }
                 enum pactype{
                     pac_none = 0,
                     pac_AA,     //BRAA  / BLRAA
@@ -136,6 +154,7 @@ namespace tihmstar{
                 uint8_t rm();
                 cond condition();
                 uint64_t special();
+                systemreg sysreg(); //mrs, msr (register)
                 
             public: //cast operators
                 operator enum type();
@@ -185,6 +204,14 @@ namespace tihmstar{
 #pragma mark literal
                 static insn new_literal_ldr(loc_t pc, uint64_t imm, uint8_t rt);
             };
+
+            //op0, op1, CRn, CRm, op2 as in the ARM ARM
+            static_assert(insn::sysreg_encode(3,0,13,0,4) == insn::tpidr_el1, "sysreg_encode mismatch");
+            static_assert(insn::sysreg_encode(3,3,13,0,2) == insn::tpidr_el0, "sysreg_encode mismatch");
+            static_assert(insn::sysreg_encode(3,0,2,0,1) == insn::ttbr1_el1, "sysreg_encode mismatch");
+            static_assert(insn::sysreg_encode(3,0,4,1,0) == insn::sp_el0, "sysreg_encode mismatch");
+            static_assert(insn::sysreg_encode(3,3,4,2,1) == insn::daif, "sysreg_encode mismatch");
+            static_assert(insn::sysreg_encode(3,6,1,0,0) == insn::sctlr_el3, "sysreg_encode mismatch");
         
         };
     };
@@ -0,0 +1,70 @@
+//
+//  cfg64.hpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef cfg64_hpp
+#define cfg64_hpp
+
+#include <stdint.h>
+#include <vector>
+
+#include <libpatchfinder/patchfinder64.hpp>
+
+namespace tihmstar {
+    namespace patchfinder{
+        /*
+            Basic blocks of a single function, discovered by following branches from its start.
+            Conditional branches (b.cond, cbz, cbnz, tbz, tbnz) split into target and fallthrough,
+            unconditional b out of [funcStart, funcEnd) is treated as a tail call and nothing is walked past funcEnd,
+            br is followed only if it dispatches through a simple jump table (cmp + adr(p) + ldrsw + add + br).
+         */
+        class cfg64{
+        public:
+            using loc_t = patchfinder64::loc_t;
+            static constexpr size_t kMaxInsns = 0x8000;
+            static constexpr size_t kMaxFuncSize = 0x20000; //b further away than that is a tail call
+            static constexpr size_t kMaxJumpTableEntries = 0x400;
+
+            struct block{
+                loc_t start;
+                loc_t end;                      //last instruction (inclusive)
+                std::vector<uint32_t> succs;    //indices into blocks()
+                std::vector<uint32_t> preds;
+                bool isRet;                     //ends in ret
+                bool isBranch;                  //ends in an immediate branch or jump table br, not a fallthrough
+
+                bool contains(loc_t pos) const {return pos >= start && pos <= end;}
+            };
+
+        private:
+            loc_t _funcStart;
+            loc_t _funcEnd;
+            std::vector<block> _blocks; //sorted by start
+
+        public:
+            /*
+                funcEnd is where the next function starts, 0 means funcStart+kMaxFuncSize
+             */
+            cfg64(const patchfinder64::vmem *mem, loc_t funcStart, loc_t funcEnd = 0);
+
+            loc_t funcStart() const {return _funcStart;}
+            loc_t funcEnd() const {return _funcEnd;}
+            const std::vector<block> &blocks() const {return _blocks;}
+            bool contains(loc_t pos) const {return block_for_loc(pos) != NULL;}
+
+            const block *block_for_loc(loc_t pos) const;
+            std::vector<const block *> successors(const block &b) const;
+            std::vector<const block *> predecessors(const block &b) const;
+            std::vector<const block *> ret_blocks() const;
+            /*
+                Branch instructions (not fallthroughs) leading to the block starting at pos, sorted
+             */
+            std::vector<loc_t> branches_to(loc_t pos) const;
+        };
+    }
+}
+
+#endif /* cfg64_hpp */
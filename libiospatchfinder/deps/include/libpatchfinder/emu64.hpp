@@ -0,0 +1,105 @@
+//
+//  emu64.hpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef emu64_hpp
+#define emu64_hpp
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+
+#include <libpatchfinder/patchfinder64.hpp>
+
+namespace tihmstar {
+    namespace patchfinder{
+        /*
+            Tiny arm64 emulator for answering "what is in xN when we get to pc".
+            Only tracks registers (every register is either known or unknown), memory is read-only:
+            loads are resolved from segments which aren't writable (and __*_CONST), everything else makes the destination unknown.
+            Control flow:
+                b               followed
+                bl, blr         stepped over, x0-x18 become unknown
+                b.cond, cb(n)z, tb(n)z
+                                taken if the condition can be evaluated, otherwise falls through
+                ret, br         halts
+            Instructions which aren't modeled clobber whatever they might write.
+            Stepping does not allocate.
+         */
+        class emu64{
+        public:
+            using loc_t = patchfinder64::loc_t;
+            using insn = patchfinder64::insn;
+            static constexpr uint32_t kDefaultBudget = 0x100;
+            static constexpr uint8_t kSP = 31;
+            /*
+                Turns a raw 64bit value loaded from slot into a pointer (e.g. for chained fixups)
+             */
+            using ptrresolver = std::function<uint64_t(loc_t slot, uint64_t raw)>;
+
+        private:
+            struct loadable{
+                const uint8_t *buf;
+                loc_t vaddr;
+                size_t size;
+            };
+            patchfinder64::vmem _iter;
+            std::vector<loadable> _loadable;
+            ptrresolver _resolver;
+            uint64_t _x[32]; //x31 is sp, xzr is handled when decoding
+            uint32_t _known;
+            uint8_t _nzcv;
+            bool _flagsKnown;
+            bool _halted;
+            loc_t _pc;
+            loc_t _lastPC;
+            uint32_t _lastOpcode;
+            uint32_t _executed;
+
+            bool load(loc_t addr, uint8_t size, bool isSigned, uint64_t &val) const;
+            bool condHolds(uint8_t cond) const;
+            void setFlags(uint64_t a, uint64_t b, uint64_t res, bool is64, bool isSub);
+            void clobberLoadStore(uint32_t op);
+            void execLoadStore(uint32_t op);
+            bool get(uint8_t r, bool isSP, uint64_t &val) const;
+            void put(uint8_t r, bool isSP, uint64_t val, bool is64);
+
+        public:
+            emu64(const patchfinder64::vmem *mem, loc_t pc, ptrresolver resolver = nullptr);
+
+            /*
+                Starts over at pc with everything unknown
+             */
+            void reset(loc_t pc);
+
+            loc_t pc() const {return _pc;}
+            loc_t lastPC() const {return _lastPC;}              //instruction executed by the last step
+            uint32_t lastOpcode() const {return _lastOpcode;}
+            uint32_t executed() const {return _executed;}
+            bool halted() const {return _halted;}
+
+            bool isKnown(uint8_t reg) const {return (_known >> reg) & 1;}
+            uint64_t reg(uint8_t reg) const;                    //throws if reg is unknown
+            void setReg(uint8_t reg, uint64_t val);
+            void clobber(uint8_t reg);
+
+            /*
+                Executes the instruction at pc(), returns false (and halts) if execution can't continue
+             */
+            bool step();
+            /*
+                Steps until pc() == where, returns false if that didn't happen within budget instructions
+             */
+            bool run_until(loc_t where, uint32_t budget = kDefaultBudget);
+            /*
+                Value of reg right before the instruction at where executes, throws if it's unknown or where wasn't reached
+             */
+            uint64_t value_at(loc_t where, uint8_t reg, uint32_t budget = kDefaultBudget);
+        };
+    }
+}
+
+#endif /* emu64_hpp */
@@ -0,0 +1,66 @@
+//
+//  freespace.hpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef freespace_hpp
+#define freespace_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <set>
+
+namespace tihmstar {
+    namespace patchfinder{
+        /*
+            Set of free address ranges (e.g. nop runs, zero filled data) handed out best-fit.
+            Extents are kept by address and by size, so lookups are O(log n).
+            Adjacent extents are coalesced, allocations split the extent they are taken from.
+         */
+        class freespace{
+        public:
+            using loc_t = uint64_t;
+
+        private:
+            std::map<loc_t, size_t> _byAddr;                //start -> size
+            std::set<std::pair<size_t, loc_t>> _bySize;     //{size, start}
+
+            void insert(loc_t start, size_t size);
+            void erase(std::map<loc_t, size_t>::iterator e);
+
+        public:
+            /*
+                Marks [start, start+size) as free, merging it with neighbouring extents.
+                Throws if it overlaps something which is already free.
+             */
+            void add(loc_t start, size_t size);
+            /*
+                Takes [start, start+size) out of whatever extents it overlaps, a range running past the end of the address space is cut there
+             */
+            void remove(loc_t start, size_t size);
+            /*
+                Takes everything at or above start out
+             */
+            void remove_from(loc_t start);
+
+            /*
+                Start of the smallest extent holding at least size bytes (lowest address on ties), 0 if there is none
+             */
+            loc_t find(size_t size) const;
+            /*
+                Like find, but takes the first size bytes of that extent
+             */
+            loc_t alloc(size_t size);
+
+            bool empty() const {return _byAddr.empty();}
+            size_t extents() const {return _byAddr.size();}
+            size_t bytes() const;
+            const std::map<loc_t, size_t> &byAddr() const {return _byAddr;}
+        };
+    }
+}
+
+#endif /* freespace_hpp */
@@ -26,14 +26,16 @@ namespace tihmstar {
         class ibootpatchfinder64 : public patchfinder64, public ibootpatchfinder {
         protected:            
             ibootpatchfinder64(bool freeBuf);
+            /*
+                Only keeps nops before the end of code
+             */
+            virtual void loadFreeCode(uint32_t nopOpcode) override;
         public:
             
             static ibootpatchfinder64 *make_ibootpatchfinder64(const char *filename);
             static ibootpatchfinder64 *make_ibootpatchfinder64(const void *buffer, size_t bufSize, bool takeOwnership = false);
             virtual ~ibootpatchfinder64();
             
-            virtual loc_t findnops(uint16_t nopCnt, bool useNops = true, uint32_t nopOpcode = 0xd503201f /*nop insn*/) override;
-            
             virtual loc64_t find_base() override;
             virtual std::vector<patch> get_replace_string_patch(std::string needle, std::string replacement) override;
         };
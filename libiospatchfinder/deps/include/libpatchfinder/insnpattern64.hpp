@@ -0,0 +1,128 @@
+//
+//  insnpattern64.hpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef insnpattern64_hpp
+#define insnpattern64_hpp
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include <initializer_list>
+
+#include <libpatchfinder/patchfinder64.hpp>
+
+namespace tihmstar {
+    namespace patchfinder{
+        /*
+            Matches sequences of consecutive arm64 instructions against raw opcodes, without decoding them.
+            Every step is one or more (mask, value) alternatives, optionally with field constraints:
+                capture(f, slot)    remember field f in slot
+                same(f, slot)       field f must equal what was captured in slot earlier
+                range(f, min, max)  field f must be within [min, max]
+            All patterns added to one matcher are dispatched on the top byte of their first opcode,
+            so a single pass over the executable segments finds every occurrence of every pattern.
+         */
+        class insnpattern64{
+        public:
+            using loc_t = patchfinder64::loc_t;
+            static constexpr int kMaxAlternatives = 4;
+            static constexpr int kMaxConstraints = 3;
+            static constexpr int kMaxCaptures = 8;
+
+            struct field{
+                uint8_t lsb;
+                uint8_t width;
+                constexpr uint32_t get(uint32_t opcode) const {return (opcode >> lsb) & (uint32_t)((1ULL << width)-1);}
+            };
+            static constexpr field kRd{0,5};
+            static constexpr field kRt{0,5};
+            static constexpr field kRn{5,5};
+            static constexpr field kRt2{10,5};
+            static constexpr field kRm{16,5};
+            static constexpr field kImm12{10,12};
+            static constexpr field kImm16{5,16};
+            static constexpr field kImm19{5,19};
+            static constexpr field kImm26{0,26};
+            static constexpr field kSysreg{5,15}; //o0:op1:CRn:CRm:op2 of mrs/msr
+
+            class step{
+                enum kind : uint8_t{
+                    kCapture,
+                    kSame,
+                    kRange
+                };
+                struct alternative{
+                    uint32_t mask;
+                    uint32_t value;
+                };
+                struct constraint{
+                    kind k;
+                    field f;
+                    uint8_t slot;
+                    uint32_t min;
+                    uint32_t max;
+                };
+                alternative _alts[kMaxAlternatives];
+                constraint _constraints[kMaxConstraints];
+                uint8_t _altCnt;
+                uint8_t _constraintCnt;
+
+                step &addConstraint(constraint c);
+                friend class insnpattern64;
+            public:
+                step(uint32_t mask, uint32_t value);
+                step &orOp(uint32_t mask, uint32_t value);
+                step &capture(field f, uint8_t slot);
+                step &same(field f, uint8_t slot);
+                step &range(field f, uint32_t min, uint32_t max);
+                step &equals(field f, uint32_t val) {return range(f, val, val);}
+
+                bool matches(uint32_t opcode) const;
+            };
+
+            struct match{
+                uint32_t pattern;   //id returned by add
+                loc_t where;        //first instruction
+                uint32_t captures[kMaxCaptures];
+            };
+
+        private:
+            std::vector<std::vector<step>> _patterns;
+            std::vector<uint32_t> _dispatch[0x100]; //top opcode byte -> pattern ids
+
+            bool matchAt(const std::vector<step> &steps, const uint32_t *insns, size_t cnt, uint32_t *captures) const;
+
+        public:
+            insnpattern64();
+            insnpattern64(std::initializer_list<std::vector<step>> patterns);
+
+            /*
+                Returns the id of the pattern, ids are assigned in order starting at 0
+             */
+            uint32_t add(std::vector<step> steps);
+            size_t size() const {return _patterns.size();}
+
+            /*
+                cb returns false to stop scanning
+             */
+            void scan(const uint32_t *insns, size_t cnt, loc_t vaddr, std::function<bool(const match &m)> cb) const;
+            void scan(const patchfinder64::vmem *mem, std::function<bool(const match &m)> cb) const;
+            std::vector<match> findAll(const patchfinder64::vmem *mem) const;
+            /*
+                First match of pattern (in address order), throws if there is none
+             */
+            match findFirst(const patchfinder64::vmem *mem, uint32_t pattern = 0) const;
+
+#pragma mark common steps
+            static step any();
+            static step branch_imm(); //b, bl, b.cond, cbz, cbnz, tbz, tbnz
+        };
+    }
+}
+
+#endif /* insnpattern64_hpp */
@@ -15,11 +15,39 @@
 namespace tihmstar {
     namespace patchfinder {
         class kernelpatchfinder64 : public machopatchfinder64, public kernelpatchfinder{
+        public:
+            enum symbolmode{
+                kSymbolModeOff,     //heuristics only
+                kSymbolModePrefer,  //resolve through symbols if the kernel has them, heuristics otherwise (default)
+                kSymbolModeVerify   //always run heuristics and check their results against symbols
+            };
+            struct symbolmismatch{
+                std::string finder;
+                std::string symbol;
+                loc64_t heuristic;
+                loc64_t symbolLoc;
+            };
+        private:
+            symbolmode _symbolMode;
+            uint32_t _xnuVersion;
+            std::vector<symbolmismatch> _symbolMismatches;
+
             kernelpatchfinder64(machopatchfinder64 &&mv);
+            uint32_t xnuVersion();
+            loc64_t resolve_known_sym(const char *finder, std::string *outSymbol);
         protected:
             kernelpatchfinder64(kernelpatchfinder64 &&mv);
             kernelpatchfinder64(const char *filename);
             kernelpatchfinder64(const void *buffer, size_t bufSize, bool takeOwnership = false);
+
+            /*
+                Symbol-first resolution, see knownsyms64.h for the finder -> symbol table.
+                Both take the finder's __PRETTY_FUNCTION__, mismatches are recorded as "class::finder".
+                find_known_sym returns 0 if the finder should fall back to its heuristic.
+                verify_known_sym records a mismatch if the heuristic disagrees with the symbol (verify mode only).
+             */
+            loc64_t find_known_sym(const char *prettyFunction);
+            void verify_known_sym(const char *prettyFunction, loc64_t heuristic);
         public:
             kernelpatchfinder64(const kernelpatchfinder64 &cpy) = delete;
             virtual ~kernelpatchfinder64();
@@ -31,6 +59,14 @@ namespace tihmstar {
 
             virtual std::vector<patch> get_replace_string_patch(std::string needle, std::string replacement) override;
 
+#pragma mark symbol resolution
+            /*
+                Changing the mode drops all cached finder results
+             */
+            void setSymbolMode(symbolmode mode);
+            symbolmode getSymbolMode() const {return _symbolMode;};
+            const std::vector<symbolmismatch> &getSymbolMismatches() const {return _symbolMismatches;};
+
             
 #pragma mark static
             static kernelpatchfinder64 *make_kernelpatchfinder64(const char *filename);
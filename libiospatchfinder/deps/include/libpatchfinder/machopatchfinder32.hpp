@@ -9,16 +9,28 @@
 #define machopatchfinder32_hpp
 
 #include <libpatchfinder/patchfinder32.hpp>
+#include <string_view>
+#include <unordered_map>
 
 struct symtab_command;
 namespace tihmstar {
     namespace patchfinder {
         
         class machopatchfinder32 : public patchfinder32{
+            struct symaddr{
+                loc_t addr;
+                const char *name;
+                bool isDefined; //N_SECT, not a stab or undefined
+            };
             const struct symtab_command *__symtab;
-            
+            //built once on first lookup, names point into the strtab
+            std::unordered_map<std::string_view, loc_t> __symsByName;
+            std::vector<symaddr> __symsByAddr;
+            bool __symIndexLoaded;
+
             void loadSegments();
             __attribute__((always_inline)) const struct symtab_command *getSymtab();
+            void loadSymIndex();
             
             void init();
             
@@ -32,6 +44,10 @@ namespace tihmstar {
             bool haveSymbols() { return __symtab != NULL;};
             loc_t find_sym(const char *sym);
             std::string sym_for_addr(loc_t addr);
+            /*
+                Nearest symbol at or below addr, returns {symbol, addr - symbol address}
+             */
+            std::pair<std::string,uint32_t> symbolicate(loc_t addr);
             loc_t bl_jump_stub_ptr_loc(loc_t bl_insn);
         };
     };
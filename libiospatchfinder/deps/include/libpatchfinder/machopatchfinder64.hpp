@@ -10,19 +10,70 @@
 #define machopatchfinder64_hpp
 
 #include <libpatchfinder/patchfinder64.hpp>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
 
 struct symtab_command;
 namespace tihmstar {
     namespace patchfinder {
         
         class machopatchfinder64 : public patchfinder64{
+        public:
+            struct vsection{
+                const uint8_t *buf;
+                size_t size;
+                loc_t vaddr;
+                libinsn::vmprot perms; //of the containing segment
+                uint32_t type; //SECTION_TYPE bits of the section flags
+                std::string segname;
+                std::string sectname;
+                std::string bundleID; //empty if not part of a fileset entry
+            };
+            struct rebase{
+                loc_t slot;
+                loc_t target; //decoded, unsigned address
+                uint16_t diversity;
+                uint8_t format; //DYLD_CHAINED_PTR_*, 0 for __thread_starts chains
+                uint8_t key : 2;
+                uint8_t addrDiv : 1;
+                uint8_t isAuth : 1;
+            };
+        private:
+            struct symaddr{
+                loc_t addr;
+                const char *name;
+                bool isDefined; //N_SECT, not a stab or undefined
+            };
             std::vector<std::pair<const struct symtab_command *,uint8_t *>> __symtabs;
-            
-            std::vector<libinsn::vsegment> loadSegmentsForMachHeader(void *mh);
+            //built once on first lookup, names point into the strtabs
+            std::unordered_map<std::string_view, loc_t> __symsByName;
+            std::vector<symaddr> __symsByAddr;
+            bool __symIndexLoaded;
+            //fileset kernelcaches only, keyed by bundle ID
+            std::map<std::string, std::vector<libinsn::vsegment>> __kextSegments;
+            std::map<std::string, std::unique_ptr<const vmem>> __kextVmems;
+            std::vector<vsection> __sections;
+            std::map<std::string, std::unique_ptr<const vmem>> __sectionVmems;
+            //decoded once on first use
+            std::vector<rebase> __rebases; //sorted by slot
+            std::vector<uint32_t> __rebasesByTarget; //indices into __rebases, sorted by target
+            bool __rebasesLoaded;
+
+            std::vector<libinsn::vsegment> loadSegmentsForMachHeader(void *mh, const char *bundleID = NULL);
+            void loadSectionsForSegment(const void *seg, const char *bundleID);
             void loadSegments();
             __attribute__((always_inline)) const std::vector<std::pair<const struct symtab_command *,uint8_t *>> &getSymtabs();
+            void loadSymIndex();
+            void loadRebases();
+            void loadChainedFixups(std::vector<rebase> &rebases);
+            void loadThreadStarts(std::vector<rebase> &rebases);
             
             void init();
+
+        protected:
+            virtual void loadDataRefs() override;
+            virtual emu64 emulator(const vmem *mem, loc_t pc) override;
             
         public:
             machopatchfinder64(const char *filename);
@@ -34,8 +85,53 @@ namespace tihmstar {
             bool haveSymbols() { return __symtabs.size();};
             loc_t find_sym(const char *sym);
             std::string sym_for_addr(loc_t addr);
+            /*
+                Nearest symbol at or below addr, returns {symbol, addr - symbol address}
+             */
+            std::pair<std::string,uint64_t> symbolicate(loc_t addr);
             loc_t bl_jump_stub_ptr_loc(loc_t bl_insn);
-            
+
+#pragma mark kexts
+            /*
+                Segments of a single kext in a fileset kernelcache, looked up by bundle ID (e.g. "com.apple.security.sandbox").
+                Falls back to the whole kernel if there is no such kext (e.g. pre-fileset kernelcaches), so finders can use it unconditionally.
+             */
+            const vmem *vmem_for_kext(const char *bundleID);
+            bool haveKext(const char *bundleID) noexcept;
+            loc_t findstr_in_kext(const char *bundleID, std::string str, bool hasNullTerminator, loc_t startAddr = 0);
+            loc_t find_literal_ref_in_kext(const char *bundleID, loc_t pos, int ignoreTimes = 0, loc_t startPos = 0);
+            loc_t memmem_in_kext(const char *bundleID, const void *little, size_t little_len, loc_t startLoc = 0);
+
+#pragma mark sections
+            const std::vector<vsection> &getSections() const {return __sections;};
+            /*
+                All sections named sectname (e.g. "__cstring", "__text", "__const", "__auth_ptr"), optionally restricted
+                to a segment and/or a kext. Sections keep the permissions of their segment, so getIter(pos, kVMPROTEXEC) works as usual.
+                Falls back to the whole kernel if no section matches.
+             */
+            const vmem *vmem_for_section(const char *sectname, const char *segname = NULL, const char *bundleID = NULL);
+            loc_t findstr_in_section(const char *sectname, std::string str, bool hasNullTerminator, loc_t startAddr = 0);
+
+#pragma mark fixups
+            /*
+                Pointers in arm64e kernelcaches are stored as fixup chains (LC_DYLD_CHAINED_FIXUPS or __TEXT,__thread_starts),
+                these get decoded once into a table of rebased pointers.
+             */
+            bool haveRebases();
+            const rebase *rebase_for_loc(loc_t slot);
+            /*
+                Like deref, but returns the rebased target if pos holds a chained pointer
+             */
+            loc_t deref_rebased(loc_t pos);
+            /*
+                All slots holding a chained pointer to target, sorted
+             */
+            std::vector<loc_t> find_rebased_ptr_refs(loc_t target);
+            /*
+                Value to write at slot so that it points to target, keeping the slot's chain and signing info intact.
+                Returns target as is if slot doesn't hold a chained pointer.
+             */
+            uint64_t encode_rebased(loc_t slot, loc_t target);
         };
         
     };
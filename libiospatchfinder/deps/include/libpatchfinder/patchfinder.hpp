@@ -40,6 +40,8 @@ namespace tihmstar {
             bool _freeBuf;
             const uint8_t *_buf;
             size_t _bufSize;
+            size_t _bufOffset; //_buf may point into the allocation (e.g. fat slice), this is what we need to go back before freeing
+            size_t _bufMapSize; //if set, the allocation was mmap'd and needs to be munmap'd instead of freed
             loc_t _entrypoint;
             loc_t _base;
         public:
@@ -13,25 +13,158 @@
 #include <vector>
 #include <functional>
 #include <map>
+#include <array>
+#include <list>
+#include <memory>
 
 #include <stdint.h>
 #include <stdlib.h>
 
 #include <libpatchfinder/patchfinder.hpp>
+#include <libpatchfinder/freespace.hpp>
+#include <libpatchfinder/ptrauth.hpp>
 #include <libinsn/vmem.hpp>
 
 namespace tihmstar {
     namespace patchfinder{
+        class cfg64;
+        class emu64;
         class patchfinder64 : public patchfinder {
         public:
             using vmem = tihmstar::libinsn::vmem<tihmstar::libinsn::arm64::insn>;
             using vsegment = tihmstar::libinsn::vsegment;
             using loc_t = tihmstar::libinsn::arm64::insn::loc_t;
             using offset_t = tihmstar::libinsn::arm64::insn::offset_t;
+            using insn = tihmstar::libinsn::arm64::insn;
+            /*
+                Gets fed every instruction of the shared scan (decoded once for all visitors), iter points at isn and must be left there.
+                Returns true once it doesn't need any more instructions.
+                finish (optional) is called once the visitor is done or the scan reached the end.
+             */
+            struct scanvisitor{
+                std::function<bool(insn &isn, vmem &iter)> visit;
+                std::function<void()> finish;
+            };
+            /*
+                "movk xN, #disc, lsl #48" and the pac, aut or b(l)ra instruction using xN as modifier within the next kPACUseWindow instructions
+             */
+            struct pacdisc{
+                loc_t movk;
+                loc_t use;          //0 if there is none
+                uint16_t disc;
+                uint8_t modReg;     //xN
+                uint8_t ptrReg;     //register signed, authenticated or branched to by use
+            };
+            struct sysregaccess{
+                loc_t pc;
+                insn::systemreg sysreg;
+                uint8_t rt;
+                bool isMSR;         //write, otherwise mrs
+            };
         protected:
             const tihmstar::libinsn::vmem<libinsn::arm64::insn> *_vmem;
-            std::vector<std::pair<loc_t, size_t>> _unusedNops;
             std::map<std::string,std::vector<patch>> _savedPatches;
+            //built once on first use, sorted by value then slot
+            std::vector<std::pair<uint64_t, loc_t>> _dataRefs;
+            bool _dataRefsLoaded;
+            std::map<std::string, scanvisitor> _scanVisitors; //pending
+            bool _scanVisitorsRegistered;
+            //find_register_value state per function start, with a snapshot every kRegTraceStride instructions
+            static constexpr int kRegTraceStride = 16;
+            static constexpr size_t kRegTraceMaxFuncs = 0x400;
+            struct regtrace{
+                std::vector<std::pair<loc_t, std::array<uint64_t, 32>>> checkpoints; //state before executing the insn at loc
+                std::array<uint64_t, 32> cur; //state before executing the insn at curPC
+                loc_t curPC;
+                uint32_t insnCnt;
+                std::list<loc_t>::iterator lru; //position in _regTraceLRU
+            };
+            std::map<loc_t, regtrace> _regTraces;
+            std::list<loc_t> _regTraceLRU; //function starts, most recently used first
+            //every ret, br and blr with up to kGadgetMaxInsns-1 instructions leading into it, sorted by ops
+            static constexpr int kGadgetMaxInsns = 4;
+            struct gadget{
+                loc_t end;                          //the terminator
+                uint32_t ops[kGadgetMaxInsns];      //terminator first, then going backwards
+                uint8_t cnt;
+            };
+            std::vector<gadget> _gadgets;
+            bool _gadgetsLoaded;
+            //most recently used first
+            static constexpr size_t kCFGCacheSize = 32;
+            std::list<std::shared_ptr<const cfg64>> _cfgCache;
+            //filled once on first use, allocations are taken out
+            freespace _freeCode;
+            bool _freeCodeLoaded;
+            freespace _freeData;
+            bool _freeDataLoaded;
+            //every pacdisc sorted by disc then address, those for disc are [_pacDiscStart[disc], _pacDiscStart[disc+1])
+            static constexpr int kPACUseWindow = 16;
+            std::vector<pacdisc> _pacDiscs;
+            std::vector<uint32_t> _pacDiscStart;
+            bool _pacDiscsLoaded;
+            //every mrs and msr (register), sorted by sysreg then address
+            std::vector<sysregaccess> _sysregAccesses;
+            bool _sysregAccessesLoaded;
+
+            loc_t find_literal_ref_in_vmem(const vmem *mem, loc_t pos, int ignoreTimes, loc_t startPos);
+            /*
+                Adds every 8-byte aligned slot in seg that holds a pointer into the image
+             */
+            void addDataRefsForSegment(const vsegment &seg);
+            /*
+                Fills _dataRefs, by default from all non-executable segments (or everything, if all segments are executable)
+             */
+            virtual void loadDataRefs();
+            /*
+                Calls loadDataRefs and sorts the result, once
+             */
+            void indexDataRefs();
+
+#pragma mark shared scan
+            /*
+                Called once before the first shared scan, subscribes the gadget, pointer auth and system register indexers
+                so whichever is needed first builds all of them. Subclasses subscribe their visitors here (and call their parent)
+             */
+            virtual void registerScanVisitors();
+            void subscribe_scan(std::string name, scanvisitor visitor);
+            /*
+                One pass over the executable segments feeding all pending visitors, ends early once all of them are done
+             */
+            void run_scan();
+            scanvisitor gadgetScanVisitor();
+            scanvisitor pacDiscScanVisitor();
+            scanvisitor sysregScanVisitor();
+
+            /*
+                Emulator over mem starting at pc, subclasses hook up how their pointers are stored
+             */
+            virtual emu64 emulator(const vmem *mem, loc_t pc);
+
+            /*
+                Builds _gadgets with the shared scan
+             */
+            void loadGadgets();
+
+#pragma mark free space
+            /*
+                Fills _freeCode with runs of at least kMinNopRun nopOpcode (or zero) words in executable memory
+             */
+            static constexpr size_t kMinNopRun = 11;
+            virtual void loadFreeCode(uint32_t nopOpcode);
+            /*
+                Fills _freeData with writable memory known to be unused. Nothing by default.
+             */
+            virtual void loadFreeData();
+
+            /*
+                Builds _pacDiscs with the shared scan
+             */
+            void loadPACDiscs();
+            /*
+                Builds _sysregAccesses with the shared scan
+             */
+            void loadSysregAccesses();
 
         public:
             patchfinder64(bool freeBuf);
@@ -63,6 +196,58 @@ namespace tihmstar {
             uint64_t pte_vma_to_index(uint32_t pagesize, uint8_t level, uint64_t address);
             uint64_t pte_index_to_vma(uint32_t pagesize, uint8_t level, uint64_t index);
 
+            /*
+                All 8-byte aligned data slots holding a pointer to ptr, sorted
+             */
+            std::vector<loc_t> find_data_refs(loc_t ptr);
+            /*
+                Like find_data_refs, but returns a single slot and throws if there is none
+             */
+            loc_t find_data_ref(loc_t ptr, int ignoreTimes = 0);
+            /*
+                Start of the first function with a prologue after the one starting at bof, bof+limit if there is none before that
+             */
+            loc_t find_next_bof(loc_t bof, size_t limit);
+            /*
+                Control flow graph of the function containing pos, the last few graphs are kept around
+             */
+            std::shared_ptr<const cfg64> cfg_for_function(loc_t pos);
+            /*
+                Value of reg right before where executes, emulating at most budget instructions starting at start.
+                Throws if where isn't reached or the value is unknown there.
+             */
+            uint64_t emulate_register_value(loc_t start, loc_t where, uint8_t reg, uint32_t budget = 0x100);
+            /*
+                Starts of all gadgets consisting of exactly opcodes, sorted.
+                The last opcode has to be a ret, br or blr, at most kGadgetMaxInsns opcodes.
+             */
+            std::vector<loc_t> find_gadgets(const std::vector<uint32_t> &opcodes);
+            loc_t find_gadget(const std::vector<uint32_t> &opcodes, int ignoreTimes = 0);
+            /*
+                First "mov x0, #n; ret" (or w0, or from xzr if n is 0)
+             */
+            loc_t find_gadget_ret_const(uint16_t n);
+            /*
+                Best fitting block of at least size bytes from loadFreeData, taken out of the pool if use is set
+             */
+            loc_t find_free_data(size_t size, bool use = true);
+            /*
+                All pointer auth discriminators disc built with movk as {begin, end}, sorted by address
+             */
+            std::pair<const pacdisc *, const pacdisc *> pac_discs(uint16_t disc);
+            /*
+                First "movk xN, #disc, lsl #48" after startPos
+             */
+            loc_t find_pac_disc_ref(uint16_t disc, int ignoreTimes = 0, loc_t startPos = 0);
+            /*
+                All mrs/msr of sysreg as {begin, end}, sorted by address
+             */
+            std::pair<const sysregaccess *, const sysregaccess *> sysreg_accesses(insn::systemreg sysreg);
+            /*
+                First mrs (or msr if isMSR is set) of sysreg after startPos
+             */
+            loc_t find_sysreg_access(insn::systemreg sysreg, bool isMSR, int ignoreTimes = 0, loc_t startPos = 0);
+
 #pragma mark own functions virtual
             virtual uint16_t getPointerAuthStringDiscriminator(const char *strDesc);
             virtual loc_t find_PACedPtrRefWithStrDesc(const char *strDesc, int ignoreTimes = 0, loc_t startPos = 0);
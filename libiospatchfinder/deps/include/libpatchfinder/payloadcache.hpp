@@ -0,0 +1,57 @@
+//
+//  payloadcache.hpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef payloadcache_hpp
+#define payloadcache_hpp
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+
+#define PAYLOADCACHE_DIR_ENV        "LIBPATCHFINDER_CACHE_DIR"
+#define PAYLOADCACHE_MAXSIZE_ENV    "LIBPATCHFINDER_CACHE_MAX_SIZE"
+#define PAYLOADCACHE_DEFAULT_MAXSIZE (2ULL*1024*1024*1024)
+
+namespace tihmstar {
+    namespace patchfinder{
+        /*
+            On-disk cache for decompressed payloads (e.g. kernelcaches), keyed by a hash of the compressed container.
+            Entries are written to a tempfile and renamed into place, so multiple processes can safely share one directory.
+            Once the directory grows beyond maxSize, least recently used entries get evicted.
+         */
+        class payloadcache{
+            std::string _dir;
+            uint64_t _maxSize;
+
+            std::string pathForKey(const std::string &key) const;
+
+        public:
+            /*
+                dir == NULL disables the cache, maxSize == 0 reads PAYLOADCACHE_MAXSIZE_ENV or falls back to the default
+             */
+            payloadcache(const char *dir, uint64_t maxSize = 0);
+
+            bool isEnabled() const;
+
+            /*
+                Returns a private, writable mapping of the cached payload, or NULL on miss.
+                The caller owns the mapping and has to munmap it.
+             */
+            const void *map(const std::string &key, size_t *outSize) const noexcept;
+
+            /*
+                Failing to store is not fatal, a warning is printed instead
+             */
+            void store(const std::string &key, const void *buf, size_t size) const noexcept;
+            void evict(const std::string &keep = "") const;
+
+            static std::string keyForBuffer(const void *buf, size_t size);
+        };
+    }
+}
+
+#endif /* payloadcache_hpp */
@@ -0,0 +1,72 @@
+//
+//  ptrauth.hpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef ptrauth_hpp
+#define ptrauth_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string_view>
+
+namespace tihmstar {
+    namespace patchfinder{
+        namespace ptrauth{
+            /*
+                SipHash-2-4, usable in constant expressions
+             */
+            constexpr uint64_t siphash24(std::string_view in, uint64_t k0, uint64_t k1){
+                uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+                uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+                uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+                uint64_t v3 = 0x7465646279746573ULL ^ k1;
+                auto rotl = [](uint64_t x, int b){return (x << b) | (x >> (64 - b));};
+                auto sipround = [&]{
+                    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+                    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+                    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+                    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+                };
+                auto compress = [&](uint64_t m){
+                    v3 ^= m;
+                    sipround();
+                    sipround();
+                    v0 ^= m;
+                };
+
+                size_t i = 0;
+                for (; i + 8 <= in.size(); i += 8) {
+                    uint64_t m = 0;
+                    for (int j=0; j<8; j++) m |= (uint64_t)(uint8_t)in[i+j] << (8*j);
+                    compress(m);
+                }
+                uint64_t b = (uint64_t)in.size() << 56;
+                for (int j=0; i+j < in.size(); j++) b |= (uint64_t)(uint8_t)in[i+j] << (8*j);
+                compress(b);
+
+                v2 ^= 0xff;
+                for (int r=0; r<4; r++) sipround();
+                return v0 ^ v1 ^ v2 ^ v3;
+            }
+
+            /*
+                What clang's __builtin_ptrauth_string_discriminator produces, a non-zero 16bit value.
+                Doesn't allocate, so it's fine for strings only known at runtime too.
+             */
+            constexpr uint16_t string_discriminator(std::string_view str){
+                return (uint16_t)((siphash24(str, 0x794a1079ebc9d4b5ULL, 0xd48187421b8bec6fULL) % 0xffff) + 1);
+            }
+
+            //checked against clang's StableHash.cpp
+            static_assert(string_discriminator("") == 0xe793);
+            static_assert(string_discriminator("12345678") == 0x89dd);
+            static_assert(string_discriminator("task.map") == 0x5ef8);
+            static_assert(string_discriminator("thread.machine.kstackptr") == 0xf443);
+        }
+    }
+}
+
+#endif /* ptrauth_hpp */
@@ -969,6 +969,17 @@ uint64_t insn::special(){
     }
 }
 
+insn::systemreg insn::sysreg(){
+    switch (type()) {
+        case mrs:
+        case msr:
+            return (systemreg)BIT_RANGE(_opcode, 5, 19);
+        default:
+            reterror("failed to get sysreg");
+            break;
+    }
+}
+
 
 #pragma mark cast operators
 insn::operator enum type(){
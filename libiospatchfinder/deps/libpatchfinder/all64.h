@@ -23,6 +23,14 @@
 #   define UNCACHELOC
 #endif
 
+/*
+    Kernel finders only: like UNCACHELOC/RETCACHELOC, but consult knownsyms64.h first
+    and check the heuristic result against symbols in verify mode.
+    Keyed on __PRETTY_FUNCTION__, so overrides calling their parent report mismatches separately.
+ */
+#define UNCACHELOC_SYM UNCACHELOC; do {if (loc_t symloc = find_known_sym(__PRETTY_FUNCTION__)) RETCACHELOC(symloc);} while (0)
+#define RETCACHELOC_SYM(loc) do {loc_t hloc = (loc); verify_known_sym(__PRETTY_FUNCTION__, hloc); RETCACHELOC(hloc);} while (0)
+
 #ifdef DEBUG
 static uint64_t BIT_RANGE(uint64_t v, int begin, int end) { return ((v)>>(begin)) % (1 << ((end)-(begin)+1)); }
 static uint64_t BIT_AT(uint64_t v, int pos){ return (v >> pos) % 2; }
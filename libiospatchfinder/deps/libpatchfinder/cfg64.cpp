@@ -0,0 +1,229 @@
+//
+//  cfg64.cpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include "../include/libpatchfinder/cfg64.hpp"
+#include <libgeneral/macros.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+using namespace tihmstar;
+using namespace patchfinder;
+using namespace libinsn;
+using namespace arm64;
+
+#pragma mark jump tables
+/*
+    Recognizes the usual switch lowering:
+        cmp     wIdx, #maxIdx
+        b.hi    default
+        adr(p)  xTbl, table (+ add xTbl, xTbl, #off)
+        ldrsw   xOff, [xTbl, xIdx, lsl #2]      (or wIdx, uxtw/sxtw #2)
+        add     xDst, xTbl, xOff
+        br      xDst
+    Entries are signed 32bit offsets relative to the table.
+ */
+static std::vector<cfg64::loc_t> jumpTableTargets(const patchfinder64::vmem *mem, cfg64::loc_t brLoc){
+    std::vector<cfg64::loc_t> ret;
+    try {
+        vmem<insn> iter = mem->getIter(brLoc);
+        uint8_t dst = iter().rn();
+
+        uint32_t add = (--iter).opcode();
+        if ((add & 0xffe0fc00) != 0x8b000000 || (add & 0x1f) != dst) return ret; //add xDst, xN, xM
+        uint8_t addRn = (add >> 5) & 0x1f;
+        uint8_t addRm = (add >> 16) & 0x1f;
+
+        uint32_t ldrsw = (--iter).opcode();
+        //ldrsw xOff, [xTbl, xIdx, lsl #2], option (bits 13-15) may be any of uxtw, lsl, sxtw, sxtx
+        if ((ldrsw & 0xffe01c00) != 0xb8a01800 || !(ldrsw & 0x4000)) return ret;
+        uint8_t off = ldrsw & 0x1f;
+        uint8_t tbl = (ldrsw >> 5) & 0x1f;
+        if (!((off == addRm && tbl == addRn) || (off == addRn && tbl == addRm))) return ret;
+        cfg64::loc_t ldrswLoc = iter.pc();
+
+        //table base
+        cfg64::loc_t table = 0;
+        uint64_t pageoff = 0;
+        for (int i=0; i<8 && !table; i++) {
+            insn isn = --iter;
+            if (isn == insn::adr && isn.rd() == tbl) {
+                table = isn.imm();
+            } else if (isn == insn::adrp && isn.rd() == tbl) {
+                table = isn.imm() + pageoff;
+            } else if (isn == insn::add && isn.subtype() == insn::st_immediate && isn.rd() == tbl && isn.rn() == tbl) {
+                pageoff = isn.imm();
+            }
+        }
+        if (!table) return ret;
+
+        //bound
+        uint64_t entries = 0;
+        iter = ldrswLoc;
+        for (int i=0; i<10 && !entries; i++) {
+            insn isn = --iter;
+            if (isn == insn::cmp && isn.subtype() == insn::st_immediate && isn.rd() == 31) {
+                entries = isn.imm() + 1;
+            }
+        }
+        if (!entries || entries > cfg64::kMaxJumpTableEntries) return ret;
+
+        for (uint64_t i=0; i<entries; i++) {
+            int32_t entry = (int32_t)(mem->deref(table + i*4) & 0xffffffff);
+            ret.push_back(table + (int64_t)entry);
+        }
+    } catch (tihmstar::exception &e) {
+        ret.clear();
+    }
+    return ret;
+}
+
+#pragma mark cfg64
+cfg64::cfg64(const patchfinder64::vmem *mem, loc_t funcStart, loc_t funcEnd)
+: _funcStart(funcStart), _funcEnd(funcEnd ? funcEnd : funcStart + kMaxFuncSize)
+{
+    std::set<loc_t> leaders{funcStart};
+    std::set<loc_t> visited;
+    std::map<loc_t, std::vector<loc_t>> edges; //terminator -> targets
+    std::set<loc_t> rets;
+    std::vector<loc_t> work{funcStart};
+    vmem<insn> iter = mem->getIter(funcStart);
+
+    while (work.size()) {
+        loc_t pc = work.back(); work.pop_back();
+        while (true) {
+            if (visited.count(pc)) {
+                leaders.insert(pc);
+                break;
+            }
+            if (pc >= _funcEnd) break; //fell through into the next function
+            retassure(visited.size() < kMaxInsns, "function at 0x%016llx is too big",funcStart);
+            insn isn(0,0);
+            try {
+                iter = pc;
+                isn = iter();
+            } catch (tihmstar::exception &e) {
+                break; //ran out of executable memory
+            }
+            visited.insert(pc);
+
+            auto &targets = edges[pc];
+            auto addTarget = [&](loc_t tgt){
+                if (tgt < funcStart || tgt >= _funcEnd) return; //tail call
+                if (std::find(targets.begin(), targets.end(), tgt) != targets.end()) return;
+                targets.push_back(tgt);
+                leaders.insert(tgt);
+                if (!visited.count(tgt)) work.push_back(tgt);
+            };
+            bool isTerminator = true;
+            switch (isn.type()) {
+                case insn::ret:
+                    rets.insert(pc);
+                    break;
+                case insn::b:
+                    addTarget(isn.imm());
+                    break;
+                case insn::bcond:
+                case insn::cbz:
+                case insn::cbnz:
+                case insn::tbz:
+                case insn::tbnz:
+                    addTarget(isn.imm());
+                    addTarget(pc+4);
+                    break;
+                case insn::br:
+                    for (loc_t tgt : jumpTableTargets(mem, pc)) addTarget(tgt);
+                    break;
+                default:
+                    isTerminator = false;
+                    break;
+            }
+            if (!isTerminator) {
+                edges.erase(pc);
+                pc += 4;
+                continue;
+            }
+            break;
+        }
+    }
+
+    //split the discovered instructions into blocks
+    std::map<loc_t, uint32_t> blockForStart;
+    for (loc_t pc : visited) {
+        if (_blocks.size()) {
+            block &cur = _blocks.back();
+            if (!leaders.count(pc) && pc == cur.end + 4 && edges.find(cur.end) == edges.end()) {
+                cur.end = pc;
+                continue;
+            }
+        }
+        blockForStart[pc] = (uint32_t)_blocks.size();
+        _blocks.push_back({pc, pc, {}, {}, false, false});
+    }
+
+    for (uint32_t i=0; i<_blocks.size(); i++) {
+        block &b = _blocks[i];
+        auto e = edges.find(b.end);
+        b.isRet = rets.count(b.end);
+        b.isBranch = e != edges.end() && !b.isRet;
+        if (e != edges.end()) {
+            for (loc_t tgt : e->second) {
+                auto s = blockForStart.find(tgt);
+                if (s != blockForStart.end()) b.succs.push_back(s->second);
+            }
+        } else {
+            auto s = blockForStart.find(b.end + 4);
+            if (s != blockForStart.end()) b.succs.push_back(s->second);
+        }
+        for (uint32_t s : b.succs) _blocks[s].preds.push_back(i);
+    }
+    debug("cfg for 0x%016llx has %zu blocks",funcStart,_blocks.size());
+}
+
+const cfg64::block *cfg64::block_for_loc(loc_t pos) const{
+    auto b = std::upper_bound(_blocks.begin(), _blocks.end(), pos, [](loc_t pos, const block &b){
+        return pos < b.start;
+    });
+    if (b == _blocks.begin()) return NULL;
+    --b;
+    return b->contains(pos) ? &*b : NULL;
+}
+
+std::vector<const cfg64::block *> cfg64::successors(const block &b) const{
+    std::vector<const block *> ret;
+    for (uint32_t s : b.succs) ret.push_back(&_blocks[s]);
+    return ret;
+}
+
+std::vector<const cfg64::block *> cfg64::predecessors(const block &b) const{
+    std::vector<const block *> ret;
+    for (uint32_t p : b.preds) ret.push_back(&_blocks[p]);
+    return ret;
+}
+
+std::vector<const cfg64::block *> cfg64::ret_blocks() const{
+    std::vector<const block *> ret;
+    for (auto &b : _blocks) {
+        if (b.isRet) ret.push_back(&b);
+    }
+    return ret;
+}
+
+std::vector<cfg64::loc_t> cfg64::branches_to(loc_t pos) const{
+    std::vector<loc_t> ret;
+    const block *b = block_for_loc(pos);
+    if (!b || b->start != pos) return ret;
+    for (uint32_t p : b->preds) {
+        const block &pred = _blocks[p];
+        if (!pred.isBranch) continue;
+        //a conditional branch right before pos reaches it by falling through, its target is the other successor
+        if (pred.end + 4 == pos && pred.succs.size() > 1) continue;
+        ret.push_back(pred.end);
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
@@ -0,0 +1,476 @@
+//
+//  emu64.cpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include "../include/libpatchfinder/emu64.hpp"
+#include <libgeneral/macros.h>
+#include <string.h>
+
+using namespace tihmstar;
+using namespace patchfinder;
+using namespace libinsn;
+using namespace arm64;
+
+#define BIT_RANGE(v,begin,end) ( ((v)>>(begin)) % (1ULL << ((end)-(begin)+1)) )
+#define BIT_AT(v,pos) ( ((v) >> (pos)) & 1 )
+
+static uint64_t signExtend(uint64_t v, int bits){
+    if (bits >= 64) return v;
+    uint64_t m = 1ULL << (bits-1);
+    v &= (1ULL << bits)-1;
+    return (v ^ m) - m;
+}
+
+static uint64_t ones(int n){
+    return (n >= 64) ? ~0ULL : (1ULL << n)-1;
+}
+
+static uint64_t shiftReg(uint64_t v, uint8_t type, uint8_t amount, bool is64){
+    int width = is64 ? 64 : 32;
+    v &= ones(width);
+    amount %= width;
+    switch (type) {
+        case 0: return (v << amount) & ones(width);                         //lsl
+        case 1: return v >> amount;                                         //lsr
+        case 2: return (uint64_t)((int64_t)signExtend(v, width) >> amount) & ones(width); //asr
+        default: return ((v >> amount) | (v << ((width - amount) % width))) & ones(width); //ror
+    }
+}
+
+#pragma mark emu64
+emu64::emu64(const patchfinder64::vmem *mem, loc_t pc, ptrresolver resolver)
+: _iter(mem->getIter()), _resolver(resolver)
+{
+    for (auto &seg : mem->getSegments()) {
+        if ((seg.perms & kVMPROTWRITE) && seg.segname.find("_CONST") == std::string::npos) continue;
+        _loadable.push_back({seg.buf, seg.vaddr, seg.size});
+    }
+    reset(pc);
+}
+
+void emu64::reset(loc_t pc){
+    memset(_x, 0, sizeof(_x));
+    _known = 0;
+    _nzcv = 0;
+    _flagsKnown = false;
+    _halted = false;
+    _pc = pc;
+    _lastPC = 0;
+    _lastOpcode = 0;
+    _executed = 0;
+}
+
+uint64_t emu64::reg(uint8_t reg) const{
+    retassure(reg < 32, "bad register %d",reg);
+    retassure(isKnown(reg), "x%d is unknown at 0x%016llx",reg,_pc);
+    return _x[reg];
+}
+
+void emu64::setReg(uint8_t reg, uint64_t val){
+    retassure(reg < 32, "bad register %d",reg);
+    _x[reg] = val;
+    _known |= 1U << reg;
+}
+
+void emu64::clobber(uint8_t reg){
+    _known &= ~(1U << (reg & 0x1f));
+}
+
+#pragma mark helpers
+bool emu64::get(uint8_t r, bool isSP, uint64_t &val) const{
+    if (r == 31 && !isSP) {
+        val = 0; //xzr
+        return true;
+    }
+    if (!isKnown(r)) return false;
+    val = _x[r];
+    return true;
+}
+
+void emu64::put(uint8_t r, bool isSP, uint64_t val, bool is64){
+    if (r == 31 && !isSP) return; //xzr
+    _x[r] = is64 ? val : (val & 0xffffffff);
+    _known |= 1U << r;
+}
+
+bool emu64::load(loc_t addr, uint8_t size, bool isSigned, uint64_t &val) const{
+    for (auto &l : _loadable) {
+        if (addr < l.vaddr || addr + size > l.vaddr + l.size) continue;
+        uint64_t raw = 0;
+        memcpy(&raw, l.buf + (addr - l.vaddr), size);
+        if (size == 8 && _resolver) raw = _resolver(addr, raw);
+        val = isSigned ? signExtend(raw, size*8) : raw;
+        return true;
+    }
+    return false;
+}
+
+bool emu64::condHolds(uint8_t cond) const{
+    bool n = BIT_AT(_nzcv, 3);
+    bool z = BIT_AT(_nzcv, 2);
+    bool c = BIT_AT(_nzcv, 1);
+    bool v = BIT_AT(_nzcv, 0);
+    bool ret = false;
+    switch (cond >> 1) {
+        case 0: ret = z; break;
+        case 1: ret = c; break;
+        case 2: ret = n; break;
+        case 3: ret = v; break;
+        case 4: ret = c && !z; break;
+        case 5: ret = n == v; break;
+        case 6: ret = n == v && !z; break;
+        default: return true; //al, nv
+    }
+    return (cond & 1) ? !ret : ret;
+}
+
+void emu64::setFlags(uint64_t a, uint64_t b, uint64_t res, bool is64, bool isSub){
+    int msb = is64 ? 63 : 31;
+    uint64_t m = ones(msb+1);
+    a &= m; b &= m; res &= m;
+    bool n = BIT_AT(res, msb);
+    bool z = res == 0;
+    bool c = isSub ? a >= b : res < a;
+    bool v = isSub ? BIT_AT((a ^ b) & (a ^ res), msb) : BIT_AT(~(a ^ b) & (a ^ res), msb);
+    _nzcv = (n << 3) | (z << 2) | (c << 1) | v;
+    _flagsKnown = true;
+}
+
+#pragma mark memory
+void emu64::clobberLoadStore(uint32_t op){
+    clobber(op & 0x1f);
+    if ((op & 0x3f000000) == 0x08000000) clobber(BIT_RANGE(op, 10, 14)); //exclusive pair
+    if ((op & 0xbf800000) == 0x0c800000) clobber(BIT_RANGE(op, 5, 9));   //simd structure, post-index
+}
+
+void emu64::execLoadStore(uint32_t op){
+    uint8_t rt = op & 0x1f;
+    uint8_t rn = BIT_RANGE(op, 5, 9);
+    bool isSIMD = BIT_AT(op, 26);
+    uint64_t base = 0;
+    bool haveBase = get(rn, true, base);
+
+    if ((op & 0x3a000000) == 0x28000000) {
+        //pair
+        uint8_t rt2 = BIT_RANGE(op, 10, 14);
+        uint8_t opc = op >> 30;
+        uint8_t idx = BIT_RANGE(op, 23, 24);
+        bool isLoad = BIT_AT(op, 22);
+        uint8_t size = isSIMD ? (4 << opc) : ((opc & 2) ? 8 : 4);
+        int64_t imm = signExtend(BIT_RANGE(op, 15, 21), 7) * size;
+        uint64_t addr = base + ((idx == 1) ? 0 : imm);
+        if (idx == 1 || idx == 3) {
+            if (haveBase) put(rn, true, base + imm, true);
+            else clobber(rn);
+        }
+        if (!isLoad || isSIMD) return;
+        uint64_t v1 = 0, v2 = 0;
+        bool isSigned = opc == 1; //ldpsw
+        if (haveBase && load(addr, size, isSigned, v1) && load(addr + size, size, isSigned, v2)) {
+            put(rt, false, v1, size == 8 || isSigned);
+            put(rt2, false, v2, size == 8 || isSigned);
+        } else {
+            clobber(rt);
+            clobber(rt2);
+        }
+        return;
+    }
+
+    uint64_t addr = 0;
+    bool haveAddr = false;
+    uint8_t size = op >> 30;
+    uint8_t opc = BIT_RANGE(op, 22, 23);
+
+    if ((op & 0x3b000000) == 0x18000000) {
+        //literal
+        if (isSIMD) return;
+        if (opc == 3) return; //prfm
+        addr = _pc + signExtend(BIT_RANGE(op, 5, 23), 19) * 4;
+        haveAddr = true;
+        //map ldr w, ldr x, ldrsw onto size/opc of the register forms
+        size = (opc == 1) ? 3 : 2;
+        opc = (opc == 2) ? 2 : 1;
+    } else if ((op & 0x3b000000) == 0x39000000) {
+        //unsigned offset
+        addr = base + (BIT_RANGE(op, 10, 21) << size);
+        haveAddr = haveBase;
+    } else if ((op & 0x3b200000) == 0x38000000) {
+        //unscaled, post-index, pre-index, unprivileged
+        int64_t imm = signExtend(BIT_RANGE(op, 12, 20), 9);
+        uint8_t idx = BIT_RANGE(op, 10, 11);
+        addr = base + ((idx == 1) ? 0 : imm);
+        haveAddr = haveBase;
+        if (idx == 1 || idx == 3) {
+            if (haveBase) put(rn, true, base + imm, true);
+            else clobber(rn);
+        }
+    } else if ((op & 0x3b200c00) == 0x38200800) {
+        //register offset
+        uint8_t rm = BIT_RANGE(op, 16, 20);
+        uint8_t option = BIT_RANGE(op, 13, 15);
+        uint64_t off = 0;
+        if (haveBase && get(rm, false, off)) {
+            switch (option) {
+                case 2: off &= 0xffffffff; break;           //uxtw
+                case 6: off = signExtend(off, 32); break;   //sxtw
+                default: break;                             //lsl, sxtx
+            }
+            if (BIT_AT(op, 12)) off <<= size;
+            addr = base + off;
+            haveAddr = true;
+        }
+    } else {
+        clobberLoadStore(op);
+        return;
+    }
+
+    if (isSIMD || opc == 0) return; //simd or store
+    if (size == 3 && opc >= 2) return; //prfm
+    bool isSigned = opc >= 2;
+    bool is64 = (opc == 2) || (size == 3);
+    uint64_t val = 0;
+    if (haveAddr && load(addr, 1 << size, isSigned, val)) {
+        put(rt, false, val, is64);
+    } else {
+        clobber(rt);
+    }
+}
+
+#pragma mark execution
+bool emu64::step(){
+    if (_halted) return false;
+    insn isn(0,0);
+    try {
+        if (_executed && _pc == _lastPC + 4) {
+            isn = ++_iter; //sequential, skip the segment lookup
+        } else {
+            _iter = _pc;
+            isn = _iter();
+        }
+    } catch (tihmstar::exception &e) {
+        _halted = true;
+        return false;
+    }
+    uint32_t op = isn.opcode();
+    _lastPC = _pc;
+    _lastOpcode = op;
+    _executed++;
+
+    loc_t next = _pc + 4;
+    bool is64 = BIT_AT(op, 31);
+    uint8_t rd = op & 0x1f;
+    uint8_t rn = BIT_RANGE(op, 5, 9);
+    uint8_t rm = BIT_RANGE(op, 16, 20);
+    uint64_t a = 0, b = 0;
+
+    if ((op & 0xfe000000) == 0xd6000000) {
+        //branch to register
+        if (BIT_RANGE(op, 21, 24) != 1) {
+            //br, ret, eret and their pac variants
+            _halted = true;
+            return false;
+        }
+        //blr
+        for (uint8_t i=0; i<=18; i++) clobber(i);
+        put(30, false, next, true);
+        _flagsKnown = false;
+        _pc = next;
+        return true;
+    }
+
+    switch (isn.type()) {
+        case insn::adr:
+        case insn::adrp:
+            put(rd, false, isn.imm(), true);
+            break;
+
+        case insn::add:
+        case insn::sub:
+        case insn::subs:
+        {
+            bool isSub = BIT_AT(op, 30);
+            bool setsFlags = BIT_AT(op, 29);
+            bool ok = false;
+            bool rdIsSP = !setsFlags;
+            if ((op & 0x1f000000) == 0x11000000) {
+                //immediate
+                ok = get(rn, true, a);
+                b = isn.imm();
+            } else if ((op & 0x1f200000) == 0x0b000000) {
+                //shifted register
+                rdIsSP = false;
+                ok = get(rn, false, a) && get(rm, false, b);
+                b = shiftReg(b, BIT_RANGE(op, 22, 23), BIT_RANGE(op, 10, 15), is64);
+            }
+            if (!ok) {
+                if (!setsFlags || rd != 31) clobber(rd); //cmp writes xzr
+                if (setsFlags) _flagsKnown = false;
+                break;
+            }
+            uint64_t res = isSub ? a - b : a + b;
+            if (setsFlags) setFlags(a, b, res, is64, isSub);
+            put(rd, rdIsSP, res, is64);
+            break;
+        }
+
+        case insn::movz:
+            put(rd, false, isn.imm(), is64);
+            break;
+
+        case insn::movk:
+            if (get(rd, false, a)) {
+                uint8_t shift = BIT_RANGE(op, 21, 22) * 16;
+                put(rd, false, (a & ~(0xffffULL << shift)) | isn.imm(), is64);
+            }
+            break;
+
+        case insn::mov:
+            //orr/orn (shifted register), mov is the alias with rn = xzr
+            if (get(rn, false, a) && get(rm, false, b)) {
+                b = shiftReg(b, BIT_RANGE(op, 22, 23), BIT_RANGE(op, 10, 15), is64);
+                if (BIT_AT(op, 21)) b = ~b;
+                put(rd, false, a | b, is64);
+            } else {
+                clobber(rd);
+            }
+            break;
+
+        case insn::orr:
+        case insn::and_:
+            if ((op & 0x1f800000) == 0x12000000) {
+                //immediate
+                if (get(rn, false, a)) {
+                    b = isn.imm();
+                    put(rd, true, (isn.type() == insn::orr) ? (a | b) : (a & b), is64);
+                } else {
+                    clobber(rd);
+                }
+            } else if ((op & 0x1f000000) == 0x0a000000 && get(rn, false, a) && get(rm, false, b)) {
+                //and/bic (shifted register)
+                b = shiftReg(b, BIT_RANGE(op, 22, 23), BIT_RANGE(op, 10, 15), is64);
+                if (BIT_AT(op, 21)) b = ~b;
+                put(rd, false, a & b, is64);
+            } else {
+                clobber(rd);
+            }
+            break;
+
+        case insn::lsl:
+            //ubfm, which lsl, lsr and ubfx are aliases of
+            if (get(rn, false, a)) {
+                int width = is64 ? 64 : 32;
+                uint8_t immr = BIT_RANGE(op, 16, 21);
+                uint8_t imms = BIT_RANGE(op, 10, 15);
+                a &= ones(width);
+                uint64_t res = (imms >= immr) ? ((a >> immr) & ones(imms - immr + 1)) : ((a & ones(imms + 1)) << (width - immr));
+                put(rd, false, res, is64);
+            } else {
+                clobber(rd);
+            }
+            break;
+
+        case insn::csel:
+            if (_flagsKnown && get(condHolds(BIT_RANGE(op, 12, 15)) ? rn : rm, false, a)) {
+                put(rd, false, a, is64);
+            } else {
+                clobber(rd);
+            }
+            break;
+
+        case insn::madd:
+        {
+            uint64_t c = 0;
+            if (get(rn, false, a) && get(rm, false, b) && get(BIT_RANGE(op, 10, 14), false, c)) {
+                put(rd, false, c + a*b, is64);
+            } else {
+                clobber(rd);
+            }
+            break;
+        }
+
+        case insn::ldr:
+        case insn::ldrb:
+        case insn::ldrh:
+        case insn::ldp:
+        case insn::str:
+        case insn::strb:
+        case insn::strh:
+        case insn::stp:
+            execLoadStore(op);
+            break;
+
+        case insn::b:
+            next = isn.imm();
+            break;
+
+        case insn::bl:
+            for (uint8_t i=0; i<=18; i++) clobber(i);
+            put(30, false, next, true);
+            _flagsKnown = false;
+            break;
+
+        case insn::bcond:
+            if (_flagsKnown && condHolds(op & 0xf)) next = isn.imm();
+            break;
+
+        case insn::cbz:
+        case insn::cbnz:
+            if (get(rd, false, a)) {
+                if (!is64) a &= 0xffffffff;
+                if ((a == 0) == (isn.type() == insn::cbz)) next = isn.imm();
+            }
+            break;
+
+        case insn::tbz:
+        case insn::tbnz:
+            if (get(rd, false, a)) {
+                uint8_t bit = (BIT_AT(op, 31) << 5) | BIT_RANGE(op, 19, 23);
+                if ((BIT_AT(a, bit) == 0) == (isn.type() == insn::tbz)) next = isn.imm();
+            }
+            break;
+
+        case insn::nop:
+        case insn::msr:
+        case insn::pacibsp:
+            break;
+
+        case insn::ccmp:
+            _flagsKnown = false;
+            break;
+
+        default:
+            if ((op & 0xff000000) == 0xd4000000) {
+                //svc, brk, ...
+                _halted = true;
+                return false;
+            } else if ((op & 0xffc00000) == 0xd5000000) {
+                //system, only mrs and sysl write a register
+                if (BIT_AT(op, 21)) clobber(rd);
+            } else if ((op & 0x0a000000) == 0x08000000) {
+                execLoadStore(op);
+            } else {
+                //anything else might write rd (and sp) and flags
+                clobber(rd);
+                _flagsKnown = false;
+            }
+            break;
+    }
+    _pc = next;
+    return true;
+}
+
+bool emu64::run_until(loc_t where, uint32_t budget){
+    while (_pc != where) {
+        if (!budget--) return false;
+        if (!step()) return false;
+    }
+    return true;
+}
+
+uint64_t emu64::value_at(loc_t where, uint8_t reg, uint32_t budget){
+    retassure(run_until(where, budget), "Failed to reach 0x%016llx within %u instructions",where,budget);
+    return this->reg(reg);
+}
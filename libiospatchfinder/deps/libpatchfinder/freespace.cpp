@@ -0,0 +1,97 @@
+//
+//  freespace.cpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include "../include/libpatchfinder/freespace.hpp"
+#include <libgeneral/macros.h>
+
+using namespace tihmstar;
+using namespace patchfinder;
+
+void freespace::insert(loc_t start, size_t size){
+    _byAddr[start] = size;
+    _bySize.insert({size,start});
+}
+
+void freespace::erase(std::map<loc_t, size_t>::iterator e){
+    _bySize.erase({e->second,e->first});
+    _byAddr.erase(e);
+}
+
+void freespace::add(loc_t start, size_t size){
+    if (!size) return;
+    retassure(start + size > start, "extent {0x%016llx,0x%zx} wraps around",start,size);
+    auto next = _byAddr.lower_bound(start);
+    if (next != _byAddr.end()) {
+        retassure(start + size <= next->first, "extent {0x%016llx,0x%zx} overlaps free extent at 0x%016llx",start,size,next->first);
+    }
+    if (next != _byAddr.begin()) {
+        auto prev = std::prev(next);
+        retassure(prev->first + prev->second <= start, "extent {0x%016llx,0x%zx} overlaps free extent at 0x%016llx",start,size,prev->first);
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            size += prev->second;
+            erase(prev);
+        }
+    }
+    if (next != _byAddr.end() && start + size == next->first) {
+        size += next->second;
+        erase(next);
+    }
+    insert(start, size);
+}
+
+void freespace::remove(loc_t start, size_t size){
+    if (!size) return;
+    if (start + size < start) return remove_from(start);
+    loc_t end = start + size;
+    auto e = _byAddr.upper_bound(start);
+    if (e != _byAddr.begin()) e = std::prev(e);
+    while (e != _byAddr.end() && e->first < end) {
+        loc_t eStart = e->first;
+        loc_t eEnd = e->first + e->second;
+        auto cur = e++;
+        if (eEnd <= start) continue;
+        erase(cur);
+        if (eStart < start) insert(eStart, start - eStart);
+        if (eEnd > end) insert(end, eEnd - end);
+    }
+}
+
+void freespace::remove_from(loc_t start){
+    auto e = _byAddr.upper_bound(start);
+    if (e != _byAddr.begin()) e = std::prev(e);
+    while (e != _byAddr.end()) {
+        loc_t eStart = e->first;
+        loc_t eEnd = e->first + e->second;
+        auto cur = e++;
+        if (eEnd <= start) continue;
+        erase(cur);
+        if (eStart < start) insert(eStart, start - eStart);
+    }
+}
+
+freespace::loc_t freespace::find(size_t size) const{
+    auto e = _bySize.lower_bound({size,0});
+    return e != _bySize.end() ? e->second : 0;
+}
+
+freespace::loc_t freespace::alloc(size_t size){
+    auto e = _bySize.lower_bound({size,0});
+    if (e == _bySize.end()) return 0;
+    loc_t start = e->second;
+    size_t avail = e->first;
+    _bySize.erase(e);
+    _byAddr.erase(start);
+    if (avail > size) insert(start + size, avail - size);
+    return start;
+}
+
+size_t freespace::bytes() const{
+    size_t ret = 0;
+    for (auto &e : _byAddr) ret += e.second;
+    return ret;
+}
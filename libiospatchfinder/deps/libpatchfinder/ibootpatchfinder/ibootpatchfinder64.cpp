@@ -115,22 +115,12 @@ ibootpatchfinder64::~ibootpatchfinder64(){
     //
 }
 
-ibootpatchfinder64::loc_t ibootpatchfinder64::findnops(uint16_t nopCnt, bool useNops, uint32_t nopOpcode){
-    if (_unusedNops.size() == 0) {
-        patchfinder64::findnops(nopCnt,false,nopOpcode);
-        
-        loc_t strsection = findstr("Apple Mobile Device", false) & ~3;
-        loc_t end_of_code = find_bof(strsection, true);
-        for (int i=0; i<_unusedNops.size(); i++) {
-            auto e = _unusedNops.at(i);
-            if (e.first > end_of_code) {
-                _unusedNops.erase(_unusedNops.begin() + i);
-                i--;
-            }
-        }
-    }
-    
-    return patchfinder64::findnops(nopCnt,useNops,nopOpcode);
+void ibootpatchfinder64::loadFreeCode(uint32_t nopOpcode){
+    patchfinder64::loadFreeCode(nopOpcode);
+
+    loc_t strsection = findstr("Apple Mobile Device", false) & ~3;
+    loc_t end_of_code = find_bof(strsection, true);
+    _freeCode.remove_from(end_of_code);
 }
 
 ibootpatchfinder::loc64_t ibootpatchfinder64::find_base(){
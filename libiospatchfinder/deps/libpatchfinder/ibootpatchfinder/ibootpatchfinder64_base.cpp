@@ -348,7 +348,7 @@ std::vector<patch> ibootpatchfinder64_base::get_cmd_handler_patch(const char *cm
     
     handler_str_loc++;
     
-    loc_t tableref = memmem(&handler_str_loc, sizeof(handler_str_loc));
+    loc_t tableref = find_data_ref(handler_str_loc);
     debug("tableref=0x%016llx\n",tableref);
     
     patches.push_back({tableref+8,&ptr,8});
@@ -364,7 +364,7 @@ std::vector<patch> ibootpatchfinder64_base::get_cmd_handler_callfunc_patch(const
     loc_t handler_str_loc = memmem(handler_str.c_str(), handler_str.size());
     debug("handler_str_loc=0x%016llx",handler_str_loc);
     
-    loc_t tableref = memmem(&handler_str_loc, sizeof(handler_str_loc));
+    loc_t tableref = find_data_ref(handler_str_loc);
     debug("tableref=0x%016llx",tableref);
     tableref+=8;
     
@@ -439,7 +439,7 @@ std::vector<patch> ibootpatchfinder64_base::replace_cmd_with_memcpy(const char *
     loc_t handler_str_loc = findstr(cmd_handler_str, true);
     debug("handler_str_loc=0x%016llx\n",handler_str_loc);
 
-    loc_t tableref = memmem(&handler_str_loc, sizeof(handler_str_loc));
+    loc_t tableref = find_data_ref(handler_str_loc);
     debug("tableref=0x%016llx\n",tableref);
 
     loc_t scratchbuf = _vmem->memstr("failed to execute upgrade command from new");
@@ -563,7 +563,7 @@ std::vector<patch> ibootpatchfinder64_base::get_unlock_nvram_patch(){
     loc_t debug_uarts_str = findstr("debug-uarts", true);
     debug("debug_uarts_str=0x%016llx\n",debug_uarts_str);
 
-    loc_t debug_uarts_ref = memmem(&debug_uarts_str, sizeof(debug_uarts_str));
+    loc_t debug_uarts_ref = find_data_ref(debug_uarts_str);
     debug("debug_uarts_ref=0x%016llx\n",debug_uarts_ref);
 
     loc_t setenv_whitelist = debug_uarts_ref;
@@ -614,7 +614,7 @@ std::vector<patch> ibootpatchfinder64_base::get_nvram_nosave_patch(){
     loc_t saveenv_str = findstr("saveenv", true);
     debug("saveenv_str=0x%016llx\n",saveenv_str);
 
-    loc_t saveenv_ref = memmem(&saveenv_str, sizeof(saveenv_str));
+    loc_t saveenv_ref = find_data_ref(saveenv_str);
     debug("saveenv_ref=0x%016llx\n",saveenv_ref);
 
     loc_t saveenv_cmd_func_pos = deref(saveenv_ref+8);
@@ -22,7 +22,7 @@ std::vector<patch> ibootpatchfinder64_iOS10::replace_cmd_with_memcpy(const char
     loc_t handler_str_loc = findstr(cmd_handler_str, true);
     debug("handler_str_loc=0x%016llx\n",handler_str_loc);
 
-    loc_t tableref = memmem(&handler_str_loc, sizeof(handler_str_loc));
+    loc_t tableref = find_data_ref(handler_str_loc);
     debug("tableref=0x%016llx\n",tableref);
 
     loc_t scratchbuf = _vmem->memstr("failed to execute upgrade command from new");
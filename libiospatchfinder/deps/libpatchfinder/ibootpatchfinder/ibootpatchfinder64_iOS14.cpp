@@ -9,6 +9,7 @@
 #include <libgeneral/macros.h>
 #include "ibootpatchfinder64_iOS14.hpp"
 #include "../all64.h"
+#include "../../include/libpatchfinder/insnpattern64.hpp"
 #include <string.h>
 #include <set>
 
@@ -40,8 +41,6 @@ ibootpatchfinder64_iOS14::ibootpatchfinder64_iOS14(const void *buffer, size_t bu
 
 std::vector<patch> ibootpatchfinder64_iOS14::get_sigcheck_img4_patch(){
     std::vector<patch> patches;
-    loc_t findpos = 0;
-    vmem iter = _vmem->getIter();
     
     /* We are looking for this:
      0x00000001800312dc         cmp        w8, #0x1
@@ -58,29 +57,26 @@ std::vector<patch> ibootpatchfinder64_iOS14::get_sigcheck_img4_patch(){
      0x00000001800312fc         b.ne       loc_180031a88
      */
     
-    while (!findpos) {
-        if (++iter != insn::cmp) continue;
-        
-        if (iter().imm() != 1) continue;
-        
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        if (++iter != insn::ldr || iter().imm() != 0x10) continue;
-
-        if (++iter != insn::cmp || iter().imm() != 4) continue;
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        if (++iter != insn::cmp || iter().imm() != 2) continue;
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        if (++iter != insn::cmp || iter().imm() != 1) continue;
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        
-        findpos = iter;
-    }
+    using step = insnpattern64::step;
+#define CMP_IMM(imm) step(0x7ffffc1f, 0x7100001f | ((imm) << 10)) //cmp wN/xN, #imm
+    static const insnpattern64 sigcheck{{
+        CMP_IMM(1),
+        insnpattern64::branch_imm(),
+        step(0xfffffc00, 0xf9400000 | ((0x10/8) << 10)).orOp(0xfffffc00, 0xb9400000 | ((0x10/4) << 10)), //ldr xN/wN, [xM, #0x10]
+        CMP_IMM(4),
+        insnpattern64::branch_imm(),
+        CMP_IMM(2),
+        insnpattern64::branch_imm(),
+        CMP_IMM(1),
+        insnpattern64::branch_imm(),
+    }};
+#undef CMP_IMM
+
+    loc_t findpos = sigcheck.findFirst(_vmem).where + 8*4;
     debug("findpos=0x%016llx",findpos);
 
+    vmem iter = _vmem->getIter(findpos);
+
     
     while (++iter != insn::ret);
     
@@ -109,7 +105,7 @@ std::vector<patch> ibootpatchfinder64_iOS14::get_change_reboot_to_fsboot_patch()
     loc_t rebootstr = findstr("reboot", true);
     debug("rebootstr=0x%016llx",rebootstr);
 
-    loc_t rebootrefstr = memmem(&rebootstr,sizeof(loc_t));
+    loc_t rebootrefstr = find_data_ref(rebootstr);
     debug("rebootrefstr=0x%016llx",rebootrefstr);
     
     loc_t rebootrefptr = rebootrefstr+8;
@@ -120,7 +116,7 @@ std::vector<patch> ibootpatchfinder64_iOS14::get_change_reboot_to_fsboot_patch()
 
     patches.push_back({rebootrefstr,&fsbootstr,sizeof(loc_t)}); //rewrite pointer to point to fsboot
 
-    loc_t fsbootrefstr = memmem(&fsbootstr,sizeof(loc_t));
+    loc_t fsbootrefstr = find_data_ref(fsbootstr);
     debug("fsbootrefstr=0x%016llx",fsbootrefstr);
     
     loc_t fsbootfunction = deref(fsbootrefstr+8);
@@ -8,6 +8,7 @@
 #include "ibootpatchfinder64_iOS15.hpp"
 #include <libgeneral/macros.h>
 #include "../all64.h"
+#include "../../include/libpatchfinder/insnpattern64.hpp"
 #include <string.h>
 #include <set>
 
@@ -18,8 +19,6 @@ using namespace tihmstar::libinsn::arm64;
 
 std::vector<patch> ibootpatchfinder64_iOS15::get_sigcheck_img4_patch(){
     UNCACHEPATCHES;
-    loc_t findpos = 0;
-    vmem iter = _vmem->getIter();
     
     /* We are looking for this:
      0x00000001800312e4         ldr        x8, [x19, #0x10]
@@ -33,23 +32,24 @@ std::vector<patch> ibootpatchfinder64_iOS15::get_sigcheck_img4_patch(){
      0x00000001800312fc         b.ne       loc_180031a88
      */
     
-    while (!findpos) {
-        if (++iter != insn::ldr || iter().imm() != 0x10) continue;
-
-        if (++iter != insn::cmp || iter().imm() != 4) continue;
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        if (++iter != insn::cmp || iter().imm() != 2) continue;
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        if (++iter != insn::cmp || iter().imm() != 1) continue;
-        if ((++iter).supertype() != insn::sut_branch_imm) continue;
-
-        
-        findpos = iter;
-    }
+    using step = insnpattern64::step;
+#define CMP_IMM(imm) step(0x7ffffc1f, 0x7100001f | ((imm) << 10)) //cmp wN/xN, #imm
+    static const insnpattern64 sigcheck{{
+        step(0xfffffc00, 0xf9400000 | ((0x10/8) << 10)).orOp(0xfffffc00, 0xb9400000 | ((0x10/4) << 10)).capture(insnpattern64::kRt, 0), //ldr xN/wN, [xM, #0x10]
+        CMP_IMM(4).same(insnpattern64::kRn, 0),
+        insnpattern64::branch_imm(),
+        CMP_IMM(2).same(insnpattern64::kRn, 0),
+        insnpattern64::branch_imm(),
+        CMP_IMM(1).same(insnpattern64::kRn, 0),
+        insnpattern64::branch_imm(),
+    }};
+#undef CMP_IMM
+
+    loc_t findpos = sigcheck.findFirst(_vmem).where + 6*4;
     debug("findpos=0x%016llx",findpos);
 
+    vmem iter = _vmem->getIter(findpos);
+
     while (true) {
         while (++iter != insn::ldp);
         if (++iter != insn::ldp) continue;
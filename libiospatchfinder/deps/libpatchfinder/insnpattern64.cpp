@@ -0,0 +1,165 @@
+//
+//  insnpattern64.cpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include "../include/libpatchfinder/insnpattern64.hpp"
+#include <libgeneral/macros.h>
+#include <string.h>
+
+using namespace tihmstar;
+using namespace patchfinder;
+using namespace libinsn;
+
+#pragma mark step
+insnpattern64::step::step(uint32_t mask, uint32_t value)
+: _alts{{mask, value & mask}}, _constraints{}, _altCnt(1), _constraintCnt(0)
+{
+    //
+}
+
+insnpattern64::step &insnpattern64::step::orOp(uint32_t mask, uint32_t value){
+    retassure(_altCnt < kMaxAlternatives, "too many alternatives");
+    _alts[_altCnt++] = {mask, value & mask};
+    return *this;
+}
+
+insnpattern64::step &insnpattern64::step::addConstraint(constraint c){
+    retassure(_constraintCnt < kMaxConstraints, "too many constraints");
+    retassure(c.k == kRange || c.slot < kMaxCaptures, "bad capture slot %d",c.slot);
+    _constraints[_constraintCnt++] = c;
+    return *this;
+}
+
+insnpattern64::step &insnpattern64::step::capture(field f, uint8_t slot){
+    return addConstraint({kCapture, f, slot, 0, 0});
+}
+
+insnpattern64::step &insnpattern64::step::same(field f, uint8_t slot){
+    return addConstraint({kSame, f, slot, 0, 0});
+}
+
+insnpattern64::step &insnpattern64::step::range(field f, uint32_t min, uint32_t max){
+    return addConstraint({kRange, f, 0, min, max});
+}
+
+bool insnpattern64::step::matches(uint32_t opcode) const{
+    for (uint8_t i=0; i<_altCnt; i++) {
+        if ((opcode & _alts[i].mask) == _alts[i].value) return true;
+    }
+    return false;
+}
+
+#pragma mark insnpattern64
+insnpattern64::insnpattern64(){
+    //
+}
+
+insnpattern64::insnpattern64(std::initializer_list<std::vector<step>> patterns){
+    for (auto &p : patterns) add(p);
+}
+
+uint32_t insnpattern64::add(std::vector<step> steps){
+    retassure(steps.size(), "empty pattern");
+    uint32_t id = (uint32_t)_patterns.size();
+    const step &first = steps.front();
+    //a pattern goes into every bucket its first step could match
+    for (uint32_t b=0; b<0x100; b++) {
+        for (uint8_t i=0; i<first._altCnt; i++) {
+            if (((b << 24) & first._alts[i].mask) == (first._alts[i].value & 0xff000000)) {
+                _dispatch[b].push_back(id);
+                break;
+            }
+        }
+    }
+    _patterns.push_back(std::move(steps));
+    return id;
+}
+
+bool insnpattern64::matchAt(const std::vector<step> &steps, const uint32_t *insns, size_t cnt, uint32_t *captures) const{
+    if (steps.size() > cnt) return false;
+    for (size_t s=0; s<steps.size(); s++) {
+        const step &st = steps[s];
+        uint32_t opcode = insns[s];
+        if (!st.matches(opcode)) return false;
+        for (uint8_t c=0; c<st._constraintCnt; c++) {
+            auto &cs = st._constraints[c];
+            uint32_t val = cs.f.get(opcode);
+            switch (cs.k) {
+                case step::kCapture:
+                    captures[cs.slot] = val;
+                    break;
+                case step::kSame:
+                    if (captures[cs.slot] != val) return false;
+                    break;
+                case step::kRange:
+                    if (val < cs.min || val > cs.max) return false;
+                    break;
+            }
+        }
+    }
+    return true;
+}
+
+void insnpattern64::scan(const uint32_t *insns, size_t cnt, loc_t vaddr, std::function<bool(const match &m)> cb) const{
+    match m{};
+    for (size_t i=0; i<cnt; i++) {
+        for (uint32_t id : _dispatch[insns[i] >> 24]) {
+            memset(m.captures, 0, sizeof(m.captures));
+            if (!matchAt(_patterns[id], &insns[i], cnt-i, m.captures)) continue;
+            m.pattern = id;
+            m.where = vaddr + i*4;
+            if (!cb(m)) return;
+        }
+    }
+}
+
+void insnpattern64::scan(const patchfinder64::vmem *mem, std::function<bool(const match &m)> cb) const{
+    bool stop = false;
+    for (auto &seg : mem->getSegments()) {
+        if (seg.perms != kVMPROTALL && !(seg.perms & kVMPROTEXEC)) continue;
+        loc_t vaddr = (seg.vaddr + 3) & ~3ULL;
+        size_t skip = vaddr - seg.vaddr;
+        if (seg.size <= skip) continue;
+        scan((const uint32_t*)(seg.buf + skip), (seg.size - skip)/4, vaddr, [&](const match &m)->bool{
+            return !(stop = !cb(m));
+        });
+        if (stop) break;
+    }
+}
+
+std::vector<insnpattern64::match> insnpattern64::findAll(const patchfinder64::vmem *mem) const{
+    std::vector<match> ret;
+    scan(mem, [&](const match &m)->bool{
+        ret.push_back(m);
+        return true;
+    });
+    return ret;
+}
+
+insnpattern64::match insnpattern64::findFirst(const patchfinder64::vmem *mem, uint32_t pattern) const{
+    match ret{};
+    bool found = false;
+    scan(mem, [&](const match &m)->bool{
+        if (m.pattern != pattern) return true;
+        ret = m;
+        found = true;
+        return false;
+    });
+    retassure(found, "Failed to find pattern %d",pattern);
+    return ret;
+}
+
+#pragma mark common steps
+insnpattern64::step insnpattern64::any(){
+    return step(0, 0);
+}
+
+insnpattern64::step insnpattern64::branch_imm(){
+    return step(0x7c000000, 0x14000000)     //b, bl
+        .orOp(0xff000010, 0x54000000)       //b.cond
+        .orOp(0x7e000000, 0x34000000)       //cbz, cbnz
+        .orOp(0x7e000000, 0x36000000);      //tbz, tbnz
+}
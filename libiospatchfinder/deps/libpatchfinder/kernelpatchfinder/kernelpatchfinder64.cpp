@@ -14,6 +14,9 @@
 #include "kernelpatchfinder64_iOS15.hpp"
 #include "kernelpatchfinder64_iOS16.hpp"
 #include "kernelpatchfinder64_iOS17.hpp"
+#include "knownsyms64.h"
+#include "../../include/libpatchfinder/OFexception.hpp"
+#include <string.h>
 
 using namespace std;
 using namespace tihmstar;
@@ -83,6 +86,76 @@ std::vector<patch> kernelpatchfinder64::get_replace_string_patch(std::string nee
     return patchfinder64::get_replace_string_patch(needle, replacement);
 }
 
+#pragma mark symbol resolution
+void kernelpatchfinder64::setSymbolMode(symbolmode mode){
+    _symbolMismatches.clear();
+    if (_symbolMode == mode) return;
+    _symbolMode = mode;
+    //cached results (and patches built from them) were found under the old mode
+    _savedPatches.clear();
+}
+
+uint32_t kernelpatchfinder64::xnuVersion(){
+    if (!_xnuVersion) _xnuVersion = atoi(get_xnu_kernel_version_number_string().c_str());
+    return _xnuVersion;
+}
+
+//"loc_t tihmstar::patchfinder::kernelpatchfinder64_iOS15::find_kernel_map()" -> "kernelpatchfinder64_iOS15::find_kernel_map"
+static std::string finderName(const char *prettyFunction){
+    std::string name = prettyFunction;
+    name = name.substr(0, name.find('('));
+    name = name.substr(name.rfind(' ')+1);
+    size_t func = name.rfind("::");
+    if (func != std::string::npos && func) {
+        size_t cls = name.rfind("::", func-1);
+        if (cls != std::string::npos) name = name.substr(cls+2);
+    }
+    return name;
+}
+
+kernelpatchfinder64::loc64_t kernelpatchfinder64::resolve_known_sym(const char *finder, std::string *outSymbol){
+    if (!haveSymbols()) return 0;
+    uint32_t vers = xnuVersion();
+    const char *func = strrchr(finder, ':');
+    func = func ? func+1 : finder;
+    for (auto &k : knownsyms64) {
+        if (strcmp(k.finder, func)) continue;
+        if (vers < k.minXnu || (k.maxXnu && vers >= k.maxXnu)) continue;
+        for (const char *sym : k.syms) {
+            if (!sym) break;
+            try {
+                loc64_t ret = find_sym(sym);
+                if (outSymbol) *outSymbol = sym;
+                return ret;
+            } catch (tihmstar::symbol_not_found &e) {
+                //try next variant
+            }
+        }
+    }
+    return 0;
+}
+
+kernelpatchfinder64::loc64_t kernelpatchfinder64::find_known_sym(const char *prettyFunction){
+    if (_symbolMode != kSymbolModePrefer) return 0;
+    std::string finder = finderName(prettyFunction);
+    loc64_t ret = resolve_known_sym(finder.c_str(), NULL);
+    if (ret) debug("%s: resolved through symbol 0x%016llx",finder.c_str(),ret);
+    return ret;
+}
+
+void kernelpatchfinder64::verify_known_sym(const char *prettyFunction, loc64_t heuristic){
+    if (_symbolMode != kSymbolModeVerify) return;
+    std::string finder = finderName(prettyFunction);
+    std::string sym;
+    loc64_t symloc = resolve_known_sym(finder.c_str(), &sym);
+    if (!symloc || symloc == heuristic) return;
+    for (auto &m : _symbolMismatches) {
+        if (m.finder == finder && m.heuristic == heuristic) return; //already reported, e.g. the finder ran again uncached
+    }
+    warning("%s: heuristic result 0x%016llx does not match %s=0x%016llx",finder.c_str(),heuristic,sym.c_str(),symloc);
+    _symbolMismatches.push_back({finder,sym,heuristic,symloc});
+}
+
 kernelpatchfinder64 *kernelpatchfinder64::make_kernelpatchfinder64(const void *buffer, size_t bufSize, bool takeOwnership){
     return make_kernelpatchfinder64(machopatchfinder64(buffer, bufSize, takeOwnership));
 }
@@ -95,24 +168,29 @@ kernelpatchfinder64 *kernelpatchfinder64::make_kernelpatchfinder64(const char *f
 
 kernelpatchfinder64::kernelpatchfinder64(machopatchfinder64 &&mv)
     : machopatchfinder64(std::move(mv))
+    , _symbolMode(kSymbolModePrefer), _xnuVersion(0)
 {
     //
 }
 
 kernelpatchfinder64::kernelpatchfinder64(kernelpatchfinder64 &&mv)
 : machopatchfinder64(std::move(mv))
+, _symbolMode(mv._symbolMode), _xnuVersion(mv._xnuVersion)
+, _symbolMismatches(std::move(mv._symbolMismatches))
 {
     _unusedBSS = mv._unusedBSS;
 }
 
 kernelpatchfinder64::kernelpatchfinder64(const char *filename)
 : machopatchfinder64(filename)
+, _symbolMode(kSymbolModePrefer), _xnuVersion(0)
 {
     //
 }
 
 kernelpatchfinder64::kernelpatchfinder64(const void *buffer, size_t bufSize, bool takeOwnership)
 : machopatchfinder64(buffer, bufSize, takeOwnership)
+, _symbolMode(kSymbolModePrefer), _xnuVersion(0)
 {
     //
 }
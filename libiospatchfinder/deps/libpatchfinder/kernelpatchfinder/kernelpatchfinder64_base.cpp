@@ -12,6 +12,7 @@
 #include "sbops64.h"
 #include <string.h>
 #include <set>
+#include <algorithm>
 
 using namespace std;
 using namespace tihmstar;
@@ -48,6 +49,12 @@ static void slide_ptr(class patch *p, uint64_t slide){
     memcpy((void*)p->_patch, &slide, 8);
 }
 
+#pragma mark gadgets
+patchfinder64::loc_t kernelpatchfinder64_base::find_ret0_gadget(){
+    UNCACHELOC;
+    RETCACHELOC(find_gadget_ret_const(0));
+}
+
 #pragma mark Location finders
 patchfinder64::loc_t kernelpatchfinder64_base::find_syscall0(){
     UNCACHELOC;
@@ -61,17 +68,19 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_machtrap_table(){
     UNCACHELOC;
     patchfinder64::loc_t table = 0;
     
-    vmem iter(_vmem, 0, kVMPROTALL);
+    //mach_trap_table is const, no need to look at code or writable data
+    vmem iter(vmem_for_section("__const"), 0, kVMPROTALL);
     
     for (;;iter.nextSeg()) {
         auto curSegSize = iter.curSegSize();
         auto curSegBase = iter.pc();
-        if (curSegSize < 10)
+        if (curSegSize < 4*4*8)
             continue;
         
         uint8_t *beginptr = (uint8_t *)iter.memoryForLoc(curSegBase);
         uint8_t *endptr = (uint8_t *)beginptr + iter.curSegSize();
-        for (uint8_t *p = beginptr; p < endptr; p+=8) {
+        //every candidate is compared against the 3 entries following it
+        for (uint8_t *p = beginptr; p <= endptr - 4*4*8; p+=8) {
             int onefailed = 0;
             uint64_t *pp = (uint64_t*)p;
             
@@ -111,8 +120,8 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_function_for_machtrap(int tr
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_kerneltask(){
-    UNCACHELOC;
-    patchfinder64::loc_t strloc = findstr("current_task() == kernel_task", true);
+    UNCACHELOC_SYM;
+    patchfinder64::loc_t strloc = findstr_in_section("__cstring", "current_task() == kernel_task", true);
     debug("strloc=0x%016llx\n",strloc);
     
     patchfinder64::loc_t strref = find_literal_ref(strloc);
@@ -147,7 +156,7 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_kerneltask(){
                         case insn::cmp:
                             if ((kernelreg == iter2().rm() && xreg == iter2().rn())
                                 || (xreg == iter2().rm() && kernelreg == iter2().rn())) {
-                                RETCACHELOC(kernel_task);
+                                RETCACHELOC_SYM(kernel_task);
                             }
                             break;
                         default:
@@ -220,14 +229,11 @@ std::vector<patch> kernelpatchfinder64_base::get_task_conversion_eval_patch(){
 
     vmem iter = _vmem->getIter();
     
-    while (true) {
-        try {
-            ++iter;
-        } catch (out_of_range &e) {
-            break;
-        }
+    auto accesses = sysreg_accesses(insn::tpidr_el1);
+    for (const sysregaccess *a = accesses.first; a != accesses.second; a++) {
+        iter = a->pc;
         
-        if (iter() == insn::mrs && iter().special() == insn::systemreg::tpidr_el1) {
+        if (!a->isMSR) {
             vmem iter2(iter,(patchfinder64::loc_t)iter);
             int8_t regtpidr = iter().rt();
             int8_t regThisTask = -1;
@@ -519,10 +525,10 @@ std::vector<patch> kernelpatchfinder64_base::get_cs_enforcement_disable_amfi_pat
 
 std::vector<patch> kernelpatchfinder64_base::get_amfi_validateCodeDirectoryHashInDaemon_patch(){
     UNCACHEPATCHES;
-    patchfinder64::loc_t str = findstr("int _validateCodeDirectoryHashInDaemon",false);
+    patchfinder64::loc_t str = findstr_in_kext(KEXT_AMFI, "int _validateCodeDirectoryHashInDaemon",false);
     debug("str=0x%016llx",str);
 
-    patchfinder64::loc_t ref = find_literal_ref(str);
+    patchfinder64::loc_t ref = find_literal_ref_in_kext(KEXT_AMFI, str);
     assure(ref);
     debug("ref=0x%016llx",ref);
 
@@ -558,16 +564,7 @@ std::vector<patch> kernelpatchfinder64_base::get_amfi_validateCodeDirectoryHashI
     patchfinder64::loc_t bl_amfi_memcp_loc = bl_amfi_memcp;
     debug("bl_amfi_memcp_loc=0x%016llx",bl_amfi_memcp_loc);
 
-    /* find*/
-    //movz w0, #0x0
-    //ret
-    vmem ret0 = _vmem->getIter(memcmp);
-    while (ret0() != insn::movz || ret0().rd() != 0 || ret0().imm() != 0) {
-        while (--ret0 != insn::ret)
-            ;
-        --ret0;
-    }
-    patchfinder64::loc_t ret0_gadget = ret0;
+    patchfinder64::loc_t ret0_gadget = find_ret0_gadget();
     debug("ret0_gadget=0x%016llx",ret0_gadget);
 
     patches.push_back({jscpl,&ret0_gadget,sizeof(ret0_gadget),slide_ptr});
@@ -577,11 +574,11 @@ std::vector<patch> kernelpatchfinder64_base::get_amfi_validateCodeDirectoryHashI
 std::vector<patch> kernelpatchfinder64_base::get_get_task_allow_patch(){
     UNCACHEPATCHES;
     
-    patchfinder64::loc_t amif_str = findstr("AMFI: ", false);
+    patchfinder64::loc_t amif_str = findstr_in_kext(KEXT_AMFI, "AMFI: ", false);
     debug("amfi_str=0x%016llx\n",amif_str);
 
     
-    patchfinder64::loc_t get_task_allow_str = findstr("get-task-allow", true, amif_str);
+    patchfinder64::loc_t get_task_allow_str = findstr_in_kext(KEXT_AMFI, "get-task-allow", true, amif_str);
     debug("get_task_allow_str=0x%016llx\n",get_task_allow_str);
 
     patchfinder64::loc_t get_task_allow_ref = 0;
@@ -589,7 +586,7 @@ std::vector<patch> kernelpatchfinder64_base::get_get_task_allow_patch(){
     
     get_task_allow_ref = -4;
     while (true) {
-        get_task_allow_ref = find_literal_ref(get_task_allow_str, 0, get_task_allow_ref+4);
+        get_task_allow_ref = find_literal_ref_in_kext(KEXT_AMFI, get_task_allow_str, 0, get_task_allow_ref+4);
         debug("get_task_allow_ref=0x%016llx\n",get_task_allow_ref);
         
         find_func = find_bof(get_task_allow_ref);
@@ -657,30 +654,16 @@ std::vector<patch> kernelpatchfinder64_base::get_apfs_snapshot_patch(){
 std::vector<patch> kernelpatchfinder64_base::get_sandbox_patch(){
     UNCACHEPATCHES;
     patchfinder64::loc_t sbops = find_sbops();
-    //pointer now contain linker information :o
-    sbops |= 0xffff000000000000;
-    
+
     debug("sbobs=0x%016llx",sbops);
     
-    vmem iter = _vmem->getIter();
-        
-    do{
-        ++iter;
-        while (++iter != insn::ret);
-    }while (--iter != insn::movz || iter().rd() != 0 || iter().imm() != 0);
-        
-    patchfinder64::loc_t ret0gadget = iter;
+    patchfinder64::loc_t ret0gadget = find_ret0_gadget();
     debug("ret0gadget=0x%016llx",ret0gadget);
     
-    /*
-        re-insert linker info???
-        - first mask off real 2 highest bytes
-        - then mask in highest 2 bytes of orig ptr
-     */
-    
+    //keep the slot's chain and signing info, only swap out the target
 #define PATCH_OP(loc) \
-    if (uint64_t origval = deref(loc)) { \
-        patchfinder64::loc_t tmp = (ret0gadget & 0x0000ffffffffffff) | (origval & 0xffff000000000000); \
+    if (deref(loc)) { \
+        uint64_t tmp = encode_rebased(loc, ret0gadget); \
         patches.push_back({loc,&tmp,sizeof(tmp)}); \
     }
     
@@ -757,29 +740,16 @@ std::vector<patch> kernelpatchfinder64_base::get_sandbox_patch(){
 std::vector<patch> kernelpatchfinder64_base::get_nuke_sandbox_patch(){
     UNCACHEPATCHES;
     patchfinder64::loc_t sbops = find_sbops();
-    //pointer now contain linker information :o
-    sbops |= 0xffff000000000000;
-    
+
     debug("sbobs=0x%016llx",sbops);
     
-    vmem iter = _vmem->getIter();
-    do{
-        ++iter;
-        while (++iter != insn::ret);
-    }while (--iter != insn::movz || iter().rd() != 0 || iter().imm() != 0);
-        
-    patchfinder64::loc_t ret0gadget = iter;
+    patchfinder64::loc_t ret0gadget = find_ret0_gadget();
     debug("ret0gadget=0x%016llx",ret0gadget);
     
-    /*
-        re-insert linker info???
-        - first mask off real 2 highest bytes
-        - then mask in highest 2 bytes of orig ptr
-     */
-    
+    //keep the slot's chain and signing info, only swap out the target
 #define PATCH_OP(loc) \
-    if (uint64_t origval = deref(loc)) { \
-        patchfinder64::loc_t tmp = (ret0gadget & 0x0000ffffffffffff) | (origval & 0xffff000000000000); \
+    if (deref(loc)) { \
+        uint64_t tmp = encode_rebased(loc, ret0gadget); \
         patches.push_back({loc,&tmp,sizeof(tmp)}); \
     }
 
@@ -870,10 +840,10 @@ end:
 std::vector<patch> kernelpatchfinder64_base::get_always_get_task_allow_patch(){
     UNCACHEPATCHES;
     
-    patchfinder64::loc_t str = findstr("AMFI: hook..execve() killing pid %u: %s\n", true);
+    patchfinder64::loc_t str = findstr_in_kext(KEXT_AMFI, "AMFI: hook..execve() killing pid %u: %s\n", true);
     debug("str=0x%016llx",str);
     
-    patchfinder64::loc_t ref = find_literal_ref(str);
+    patchfinder64::loc_t ref = find_literal_ref_in_kext(KEXT_AMFI, str);
     debug("ref=0x%016llx",ref);
     
     patchfinder64::loc_t bof = find_bof(ref);
@@ -1234,8 +1204,8 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_rootvnode() {
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_allproc(){
-    UNCACHELOC;
-    patchfinder64::loc_t str = findstr("\"pgrp_add : pgrp is dead adding process\"",true);
+    UNCACHELOC_SYM;
+    patchfinder64::loc_t str = findstr_in_section("__cstring", "\"pgrp_add : pgrp is dead adding process\"",true);
     retassure(str, "Failed to find str");
     
     patchfinder64::loc_t ref = find_literal_ref(str);
@@ -1247,39 +1217,26 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_allproc(){
     
     patchfinder64::loc_t retval = (patchfinder64::loc_t)find_register_value(ptr-2, 8);
     
-    RETCACHELOC(retval);
+    RETCACHELOC_SYM(retval);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_sbops(){
     UNCACHELOC;
-    patchfinder64::loc_t str = findstr("Seatbelt sandbox policy", false);
+    patchfinder64::loc_t str = findstr_in_kext(KEXT_SANDBOX, "Seatbelt sandbox policy", false);
     retassure(str, "Failed to find str");
     debug("str=0x%16llx",str);
 
-    patchfinder64::loc_t ref = 0;
-    try {
-        retassure(ref = memmem(&str, sizeof(str)), "Failed to find ref");
-    } catch (...) {
-        //pointer now contain linker information
-        debug("Failed to find full ref, retrying with masking off upper 2 bytes...");
-        retassure(ref = memmem(&str, sizeof(str)-2), "Failed to find ref");
-    }
+    patchfinder64::loc_t ref = find_data_ref(str);
+    debug("ref=0x%16llx",ref);
 
-    loc_t retval = (patchfinder64::loc_t)deref(ref+0x18);
+    loc_t retval = deref_rebased(ref+0x18);
     RETCACHELOC(retval);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_ml_io_map(){
-    UNCACHELOC;
-    try {
-        loc_t sym = find_sym("_ml_io_map");
-        return sym;
-    } catch (...) {
-        //
-    }
-    debug("Failed to find sym _ml_io_map, trying fallback method...");
+    UNCACHELOC_SYM;
     
-    loc_t str = findstr("no-dockfifo-uart",true);
+    loc_t str = findstr_in_section("__cstring", "no-dockfifo-uart",true);
     debug("str=0x%016llx",str);
     
     loc_t ref = find_literal_ref(str);
@@ -1314,7 +1271,7 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_ml_io_map(){
         }
         if (hasW2 && hasW3) {
             loc_t retval = iter;
-            RETCACHELOC(retval);
+            RETCACHELOC_SYM(retval);
         }
     nextloop:
         continue;
@@ -1323,16 +1280,9 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_ml_io_map(){
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_kernel_map(){
-    UNCACHELOC;
-    try {
-        loc_t sym = find_sym("_kernel_map");
-        return sym;
-    } catch (...) {
-        //
-    }
-    debug("Failed to find sym _kernel_map, trying fallback method...");
+    UNCACHELOC_SYM;
     
-    loc_t str = findstr("mach_vm_region failed: %d",true);
+    loc_t str = findstr_in_section("__cstring", "mach_vm_region failed: %d",true);
     debug("str=0x%016llx",str);
     
     loc_t ref = find_literal_ref(str);
@@ -1345,18 +1295,11 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_kernel_map(){
     
     loc_t kernel_map = find_register_value(iter, 0);
     
-    RETCACHELOC(kernel_map);
+    RETCACHELOC_SYM(kernel_map);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_kmem_free(){
-    UNCACHELOC;
-    try {
-        loc_t sym = find_sym("_kmem_free");
-        return sym;
-    } catch (...) {
-        //
-    }
-    debug("Failed to find sym _kmem_free, trying fallback method...");
+    UNCACHELOC_SYM;
     
     loc_t str = 0;
     try {
@@ -1372,72 +1315,45 @@ patchfinder64::loc_t kernelpatchfinder64_base::find_kmem_free(){
     
     loc_t kmem_free = find_bof(ref);
     
-    RETCACHELOC(kmem_free);
+    RETCACHELOC_SYM(kmem_free);
 }
 
-patchfinder64::loc_t kernelpatchfinder64_base::find_bss_space(uint32_t bytecnt, bool useBytes){
-    if (!_unusedBSS.size()) {
-        debug("Searching for bss space...");
-        {
-            loc_t str = findstr("packet(SPI=%u ", true);
-//            debug("str=0x%016llx",str);
-            
-            loc_t ref = find_literal_ref(str);
-//            debug("ref=0x%016llx",ref);
-            
-            vmem iter = _vmem->getIter(ref);
-            while (++iter != insn::bl)
-                ;
-            
-            loc_t pe_parse_boot_arg = iter;
-//            debug("pe_parse_boot_arg=0x%016llx",pe_parse_boot_arg);
-            
-            loc_t pos = find_register_value(pe_parse_boot_arg, 0, pe_parse_boot_arg-0x20);
-//            debug("pos=0x%016llx",pos);
-            _unusedBSS.push_back({pos,256});
-        }
-        
-        debug("Done searching for bss space!");
-        _unusedBSS.push_back({0,0}); //mark as already inited
-    }
-    retassure(_unusedBSS.size(), "Failed to find bss space");
-    
-    int besti = -1;
-    size_t bestSize = 0;
-    
-    for (int i=0; i<_unusedBSS.size(); i++) {
-        auto np = _unusedBSS.at(i);
-        if (bytecnt <= np.second) {
-            if (besti == -1 || np.second < bestSize) {
-                besti = i;
-                bestSize = np.second;
-            }
-        }
-    }
-    retassure(besti != -1, "Failed to find enough nopspace");
-    auto foundpos = _unusedBSS.at(besti);
-    if (useBytes) {
-        _unusedBSS.erase(_unusedBSS.begin() + besti);
-        if (bytecnt < bestSize) {
-            size_t remainSpaceSize = foundpos.second - bytecnt;
-            loc_t remainSpace = foundpos.first + bytecnt;
-            _unusedBSS.push_back({remainSpace,remainSpaceSize});
-        }
-        debug("consuming bss {0x%016llx,0x%016llx}",foundpos.first,foundpos.first+foundpos.second);
-    }
+void kernelpatchfinder64_base::loadFreeData(){
+    kernelpatchfinder64::loadFreeData();
+    debug("Searching for bss space...");
+    loc_t str = findstr("packet(SPI=%u ", true);
+//    debug("str=0x%016llx",str);
 
-    return foundpos.first;
+    loc_t ref = find_literal_ref(str);
+//    debug("ref=0x%016llx",ref);
+
+    vmem iter = _vmem->getIter(ref);
+    while (++iter != insn::bl)
+        ;
+
+    loc_t pe_parse_boot_arg = iter;
+//    debug("pe_parse_boot_arg=0x%016llx",pe_parse_boot_arg);
+
+    loc_t pos = find_register_value(pe_parse_boot_arg, 0, pe_parse_boot_arg-0x20);
+//    debug("pos=0x%016llx",pos);
+    _freeData.add(pos, 256);
+    debug("Done searching for bss space!");
+}
+
+patchfinder64::loc_t kernelpatchfinder64_base::find_bss_space(uint32_t bytecnt, bool useBytes){
+    return find_free_data(bytecnt, useBytes);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_pac_tag_ref(uint16_t pactag, int skip, loc_t startpos, int limit){
-    vmem iter = _vmem->getIter(startpos);
-    bool hasLimit = limit;
-    do{
-        while (++iter != insn::movk || iter().imm() != ((uint64_t)pactag << 48)){
-            if (hasLimit && !limit--) return 0;
-        }
-    }while(skip--);
-    return iter;
+    auto discs = pac_discs(pactag);
+    auto d = std::upper_bound(discs.first, discs.second, startpos, [](loc_t pos, const pacdisc &d){
+        return pos < d.movk;
+    });
+    if (discs.second - d <= skip) return 0;
+    d += skip;
+    //limit counts the instructions which aren't a match
+    if (limit > 0 && d->movk > startpos + 4*((loc_t)limit + 1 + skip)) return 0;
+    return d->movk;
 }
 
 patchfinder64::loc_t kernelpatchfinder64_base::find_boot_args_commandline_offset(){
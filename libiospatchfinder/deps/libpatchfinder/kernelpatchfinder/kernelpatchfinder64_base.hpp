@@ -11,10 +11,24 @@
 
 #include <libpatchfinder/kernelpatchfinder/kernelpatchfinder64.hpp>
 
+//bundle IDs for vmem_for_kext and friends
+#define KEXT_AMFI       "com.apple.driver.AppleMobileFileIntegrity"
+#define KEXT_APFS       "com.apple.filesystems.apfs"
+#define KEXT_SANDBOX    "com.apple.security.sandbox"
+
 namespace tihmstar {
 namespace patchfinder {
     class kernelpatchfinder64_base : public kernelpatchfinder64{
-        
+    protected:
+        /*
+            First "mov x0, #0; ret", e.g. to neuter function pointers
+         */
+        loc_t find_ret0_gadget();
+        /*
+            The boot-arg buffer pe_parse_boot_argn fills for "packet(SPI=%u ", 256 bytes
+         */
+        virtual void loadFreeData() override;
+
     public:
         kernelpatchfinder64_base(const char *filename);
         kernelpatchfinder64_base(const void *buffer, size_t bufSize, bool takeOwnership = false);
@@ -38,7 +38,7 @@ std::vector<patch> kernelpatchfinder64_iOS13::get_generic_kernelpatches(){
 
 
 patchfinder64::loc_t kernelpatchfinder64_iOS13::find_cs_blob_generation_count(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t strloc = findstr("\"success, but no blob!\"", true);
     debug("strloc=0x%016llx\n",strloc);
 
@@ -18,14 +18,17 @@ using namespace arm64;
 
 #pragma mark Offset finders
 patchfinder64::offset_t kernelpatchfinder64_iOS15::find_struct_offset_for_PACed_member(const char *strDesc){
-    loc_t ref = find_PACedPtrRefWithStrDesc(strDesc);
-    debug("ref=0x%016llx",ref);
-    
-    vmem iter = _vmem->getIter(ref);
-    uint8_t rd = iter().rd();
-    
-    while (++iter != insn::autda || iter().rn() != rd)
-        retassure(iter() != insn::ret, "Failed to find auth");
+    auto discs = pac_discs(getPointerAuthStringDiscriminator(strDesc));
+    retassure(discs.first != discs.second, "Failed to find movk of pac discriminator for '%s'",strDesc);
+    const pacdisc &ref = *discs.first;
+    debug("ref=0x%016llx",ref.movk);
+    
+    vmem iter = _vmem->getIter(ref.use ? ref.use : ref.movk);
+    if (!ref.use || iter() != insn::autda) {
+        iter = ref.movk;
+        while (++iter != insn::autda || iter().rn() != ref.modReg)
+            retassure(iter() != insn::ret, "Failed to find auth");
+    }
 
     loc_t authloc = iter;
     debug("authloc=0x%016llx",authloc);
@@ -39,14 +42,14 @@ patchfinder64::offset_t kernelpatchfinder64_iOS15::find_struct_offset_for_PACed_
 
 #pragma mark Location finders
 patchfinder64::loc_t kernelpatchfinder64_iOS15::find_kernel_map(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     try {
         loc_t sym = kernelpatchfinder64_base::find_kernel_map();
         return sym;
     } catch (...) {
         //
     }
-    debug("Failed to find sym _kernel_map, trying iOS 15.4 method...");
+    debug("Failed to find _kernel_map, trying iOS 15.4 method...");
     
     loc_t str = findstr("io_telemetry_limit",true);
     debug("str=0x%016llx",str);
@@ -91,11 +94,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS15::find_kernel_map(){
             reterror("unexpected insn. we expect adrp or adr");
     }
 end:
-    RETCACHELOC(kernel_map);
+    RETCACHELOC_SYM(kernel_map);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS15::find_kerneltask(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     patchfinder64::loc_t strloc = findstr("Attempting to set task policy on kernel_task", false);
     debug("strloc=0x%016llx\n",strloc);
     
@@ -128,14 +131,14 @@ patchfinder64::loc_t kernelpatchfinder64_iOS15::find_kerneltask(){
     for (int i=0; i<10; i++) {
         if (++iter == insn::ldr && iter().rn() == rd) {
             kerneltask += iter().imm();
-            RETCACHELOC(kerneltask);
+            RETCACHELOC_SYM(kerneltask);
         }
     }
     reterror("Failed to find kerneltask");
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS15::find_allproc(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("shutdownwait", true);
     debug("str=0x%016llx",str);
 
@@ -170,11 +173,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS15::find_allproc(){
         ;
     allproc += iter().imm();
     
-    RETCACHELOC(allproc);
+    RETCACHELOC_SYM(allproc);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS15::find_kerncontext(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("%s[%d] had to be forced closed with exit1()", false);
     debug("str=0x%016llx",str);
 
@@ -187,11 +190,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS15::find_kerncontext(){
         ;
     
     loc_t ret = find_register_value(iter, 0);
-    RETCACHELOC(ret);
+    RETCACHELOC_SYM(ret);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS15::find_vnode_getattr(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("vnode_getattr() returned", false);
     while (deref(--str) & 0xff)
         ;
@@ -206,7 +209,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS15::find_vnode_getattr(){
     while (--iter != insn::bl)
         ;
     
-    RETCACHELOC(iter().imm());
+    RETCACHELOC_SYM(iter().imm());
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS15::find_proc_p_flag_offset(){
@@ -298,14 +301,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS15::find_machtrap_table(){
     loc_t kern_invalid = find_bof(iter);
     debug("kern_invalid=0x%016llx",kern_invalid);
     
-    loc_t table_entry = 0;
-    try {
-        table_entry = memmem(&kern_invalid, 8);
-    } catch (...) {
-        //pac devce??
-        kern_invalid -= _base;
-        table_entry = memmem(&kern_invalid, 4);
-    }
+    loc_t table_entry = find_data_ref(kern_invalid);
     debug("table_entry=0x%016llx",table_entry);
 
     RETCACHELOC(table_entry);
@@ -820,14 +816,14 @@ std::vector<patch> kernelpatchfinder64_iOS15::get_insert_vfs_context_current_pat
 std::vector<patch> kernelpatchfinder64_iOS15::get_insert_setuid_patch(){
     UNCACHEPATCHES;
     
-    loc_t sbops = find_sbops() | 0xffff000000000000 ;
+    loc_t sbops = find_sbops();
     debug("sbops=0x%016llx",sbops);
 
     loc_t hook_addr = sbops+offsetof(struct mac_policy_ops,mpo_cred_label_update_execve);
     debug("hook_addr=0x%016llx",hook_addr);
 
-    loc_t orig_hook = deref(hook_addr);
-    debug("orig_hook=0x%016llx",orig_hook | 0xffff000000000000);
+    loc_t orig_hook = deref_rebased(hook_addr);
+    debug("orig_hook=0x%016llx",orig_hook);
     
     uint32_t shellcode_insn_cnt = 41; //commitment
     loc_t shellcode = findnops(shellcode_insn_cnt);
@@ -899,13 +895,12 @@ std::vector<patch> kernelpatchfinder64_iOS15::get_insert_setuid_patch(){
     pushINSN(insn::new_immediate_add(cPC, 0x400, 31, 31));
 
     assure(commit_origInsnNum == insnNum);
-    pushINSN(insn::new_immediate_b(cPC, orig_hook | 0xffffff0000000000));
+    pushINSN(insn::new_immediate_b(cPC, orig_hook));
     assert(shellcode_insn_cnt == insnNum);
 #undef cPC
     
     {
-        loc_t new_hook = (orig_hook & 0xffffff0000000000)
-                       | (shellcode & 0x000000ffffffffff);
+        uint64_t new_hook = encode_rebased(hook_addr, shellcode);
         patches.push_back({hook_addr,&new_hook,sizeof(new_hook)});
     }
     
@@ -975,10 +970,10 @@ std::vector<patch> kernelpatchfinder64_iOS15::get_tfp_anyone_allow_patch(){
     }
     
     /* ---------- patch global macf checks --------------- */
-    loc_t str = findstr("AMFI: unrestricted debugging is enabled.", false);
+    loc_t str = findstr_in_kext(KEXT_AMFI, "AMFI: unrestricted debugging is enabled.", false);
     debug("str=0x%llx",str);
     
-    loc_t ref = find_literal_ref(str);
+    loc_t ref = find_literal_ref_in_kext(KEXT_AMFI, str);
     debug("ref=0x%llx",ref);
     
     loc_t bof = find_bof(ref);
@@ -7,16 +7,31 @@
 
 #include "kernelpatchfinder64_iOS16.hpp"
 #include "../../include/libpatchfinder/OFexception.hpp"
+#include "../../include/libpatchfinder/cfg64.hpp"
+#include "../../include/libpatchfinder/emu64.hpp"
 #include <libgeneral/macros.h>
 #include "../all64.h"
 #include "sbops64.h"
 #include <string.h>
+#include <algorithm>
 
 using namespace tihmstar;
 using namespace patchfinder;
 using namespace libinsn;
 using namespace arm64;
 
+/*
+    Closest branch below pos jumping to the start of the basic block containing pos
+ */
+static patchfinder64::loc_t branch_into_block(const cfg64 &cfg, patchfinder64::loc_t pos){
+    auto block = cfg.block_for_loc(pos);
+    retassure(block, "0x%016llx is not part of the function at 0x%016llx",pos,cfg.funcStart());
+    auto brefs = cfg.branches_to(block->start);
+    auto bref = std::lower_bound(brefs.begin(), brefs.end(), block->start);
+    retassure(bref != brefs.begin(), "Failed to find branch to block at 0x%016llx",block->start);
+    return *--bref;
+}
+
 #pragma mark Info finders
 patchfinder64::offset_t kernelpatchfinder64_iOS16::find_kernel_el(){
     UNCACHELOC;
@@ -145,18 +160,20 @@ patchfinder64::offset_t kernelpatchfinder64_iOS16::find_struct__vm_map_offset_vm
 
 patchfinder64::offset_t kernelpatchfinder64_iOS16::find_ACT_CONTEXT(){
     UNCACHELOC;
-    
-    vmem iter = _vmem->getIter();
-    
-    while (true) {
-        while (++iter != insn::mrs || iter().special() != insn::tpidr_el1 || iter().rt() != 0)
-            ;
+    /*
+     mrs    x0, TPIDR_EL1
+     mrs    x1, SP_EL0
+     add    x0, x0, #ACT_CONTEXT
+     */
+    auto accesses = sysreg_accesses(insn::tpidr_el1);
+    for (const sysregaccess *a = accesses.first; a != accesses.second; a++) {
+        if (a->isMSR || a->rt != 0) continue;
+        vmem iter = _vmem->getIter(a->pc);
         if (++iter != insn::mrs || iter().special() != insn::sp_el0) continue;
         if (++iter != insn::add || iter().rd() != 0) continue;
         RETCACHELOC(iter().imm());
     }
-
-    reterror("failed to find offset");
+    reterror("Failed to find ACT_CONTEXT");
 }
 
 patchfinder64::offset_t kernelpatchfinder64_iOS16::find_ACT_CPUDATAP(){
@@ -169,16 +186,20 @@ patchfinder64::offset_t kernelpatchfinder64_iOS16::find_ACT_CPUDATAP(){
                     cbz    x18, .
      */
     
-    loc_t tgt = memmem("\x92\xD0\x38\xD5", 4);
-    debug("tgt=0x%016llx",tgt);
-    
-    vmem iter = _vmem->getIter(tgt);
-    assure(++iter == insn::cbz);
-    assure(++iter == insn::ldr);
-    uint64_t retval = iter().imm();
-    assure(++iter == insn::cbz && iter().imm() == iter.pc());
+    auto accesses = sysreg_accesses(insn::tpidr_el1);
+    for (const sysregaccess *a = accesses.first; a != accesses.second; a++) {
+        if (a->isMSR || a->rt != 18) continue;
+        debug("tgt=0x%016llx",a->pc);
+        
+        vmem iter = _vmem->getIter(a->pc);
+        if (++iter != insn::cbz) continue;
+        if (++iter != insn::ldr) continue;
+        uint64_t retval = iter().imm();
+        if (++iter != insn::cbz || iter().imm() != iter.pc()) continue;
 
-    RETCACHELOC(retval);
+        RETCACHELOC(retval);
+    }
+    reterror("Failed to find check_exception_stack");
 }
 
 patchfinder64::offset_t kernelpatchfinder64_iOS16::find_TH_KSTACKPTR(){
@@ -210,20 +231,19 @@ patchfinder64::offset_t kernelpatchfinder64_iOS16::find_struct_thread_offset_map
     loc_t bof = find_bof(ref);
     debug("bof=0x%016llx",bof);
 
-    vmem iter = _vmem->getIter(bof);
-    
-    uint16_t pachash = getPointerAuthStringDiscriminator("task.map");
+    constexpr uint16_t pachash = ptrauth::string_discriminator("task.map");
 
-    while (true) {
-    continue_loop:
-        while (++iter != insn::movk || iter().imm() != ((uint64_t)pachash<<48))
-            ;
-        loc_t hit = iter;
+    auto discs = pac_discs(pachash);
+    for (const pacdisc *d = discs.first; d != discs.second; d++) {
+        if (d->movk <= bof) continue;
+        loc_t hit = d->movk;
         debug("hit=0x%016llx",hit);
-        vmem iter2 = iter;
-        while (++iter2 != insn::str || iter2().rt() != iter().rd()){
-            if (iter2() == insn::ret) goto continue_loop;
+        vmem iter2 = _vmem->getIter(hit);
+        bool reachedRet = false;
+        while (++iter2 != insn::str || iter2().rt() != d->modReg){
+            if ((reachedRet = (iter2() == insn::ret))) break;
         }
+        if (reachedRet) continue;
         loc_t hot = iter2;
         debug("hot=0x%016llx",hot);
         
@@ -232,6 +252,7 @@ patchfinder64::offset_t kernelpatchfinder64_iOS16::find_struct_thread_offset_map
         
         RETCACHELOC(iter2().imm());
     }
+    reterror("Failed to find thread map offset");
 }
 
 patchfinder64::offset_t kernelpatchfinder64_iOS16::find_elementsize_for_zone(const char *zonedesc){
@@ -392,27 +413,8 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_boot_args_commandline_offse
     RETCACHELOC(bootargOffset);
 }
 
-patchfinder64::loc_t kernelpatchfinder64_iOS16::find_sbops(){
-    UNCACHELOC;
-    try {
-        RETCACHELOC(kernelpatchfinder64_iOS15::find_sbops());
-    } catch (...) {
-        //
-    }
-    patchfinder64::loc_t str = findstr("Seatbelt sandbox policy", false);
-    retassure(str, "Failed to find str");
-    debug("str=0x%16llx",str);
-    str -= _base;
-    patchfinder64::loc_t ref = 0;
-    retassure(ref = memmem(&str, 4), "Failed to find ref");
-    debug("ref=0x%16llx",ref);
-
-    loc_t retval = (patchfinder64::loc_t)deref(ref+0x18);
-    RETCACHELOC(retval);
-}
-
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_cdevsw(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("perfmon: %s: cdevsw_add failed:", false);
     debug("str=0x%016llx",str);
     
@@ -424,7 +426,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_cdevsw(){
         ;
     ++iter;
     
-    loc_t bref = find_branch_ref(iter, -0x400);
+    loc_t bref = branch_into_block(*cfg_for_function(iter), iter);
     debug("bref=0x%016llx",bref);
     
     iter = bref;
@@ -440,26 +442,24 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_cdevsw(){
     while (++iter != insn::bl)
         ;
     
-    while (true) {
-        loc_t dst = 0;
-        while (++iter != insn::adr && iter() != insn::adrp)
-            ;
-        dst = iter().imm();
-        if (iter() == insn::adrp) {
-            uint8_t rd = iter().rd();
-            while (++iter != insn::add || (iter().rn() != rd))
-                ;
-            dst += iter().imm();
-        }
+    //every address materialized (adr or adrp+add) after the first call is a candidate
+    emu64 emu = emulator(_vmem, iter.pc());
+    while (emu.executed() < 0x200 && emu.step()) {
+        insn isn(emu.lastOpcode(), emu.lastPC());
+        if (isn != insn::adr && (isn != insn::add || isn.subtype() != insn::st_immediate)) continue;
+        if (!emu.isKnown(isn.rd())) continue;
+        loc_t dst = emu.reg(isn.rd());
+        if (!_vmem->isInRange(dst)) continue;
         debug("candidate=0x%016llx",dst);
         if (deref(dst + 7*8) == 0 && deref(dst + 13*8) == 3) {
-            RETCACHELOC(dst);
+            RETCACHELOC_SYM(dst);
         }
     }
+    reterror("Failed to find cdevsw");
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_gPhysBase(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("illegal PA: ", false);
     while (deref(--str) & 0xff)
         ;
@@ -494,7 +494,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_gPhysBase(){
                 deref(dst + 0x08) == 0 &&
                 deref(dst + 0x10) != 0 &&
                 deref(dst + 0x18) != 0) {
-                RETCACHELOC(dst);
+                RETCACHELOC_SYM(dst);
             }
         }
     }
@@ -502,7 +502,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_gPhysBase(){
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_gVirtBase(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("illegal PA: ", false);
     while (deref(--str) & 0xff)
         ;
@@ -532,7 +532,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_gVirtBase(){
     assure(++iter == insn::ldr);
     dst += iter().imm();
 
-    RETCACHELOC(dst);
+    RETCACHELOC_SYM(dst);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_perfmon_devices(){
@@ -568,7 +568,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_perfmon_devices(){
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ptov_table(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("illegal PA: ", false);
     while (deref(--str) & 0xff)
         ;
@@ -593,11 +593,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ptov_table(){
     assure(++iter == insn::ldr);
     dst += iter().imm();
 
-    RETCACHELOC(dst);
+    RETCACHELOC_SYM(dst);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_first_phys_ppnum(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("no remap page found", false);
     while (deref(--str) & 0xff)
         ;
@@ -644,11 +644,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_first_phys_ppnum(){
     assure(++iter == insn::ldr);
     dst += iter().imm();
 
-    RETCACHELOC(dst);
+    RETCACHELOC_SYM(dst);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_pages(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("vm pages array", true);
     debug("str=0x%016llx",str);
     
@@ -662,7 +662,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_pages(){
     loc_t block = find_register_value(iter, 4);
     debug("block=0x%016llx",block);
     
-    loc_t bfunc = (deref(block +0x10) & 0xffffffff) + find_base();
+    loc_t bfunc = deref_rebased(block +0x10);
     debug("bfunc=0x%016llx",bfunc);
     
     iter = bfunc;
@@ -674,7 +674,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_pages(){
         ;
     uint64_t res = find_register_value(iter.pc()+4, iter().rt());
     
-    RETCACHELOC(res);
+    RETCACHELOC_SYM(res);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_page_array_beginning_addr(){
@@ -728,19 +728,15 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_vm_page_array_ending_addr()
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_function_vn_kqfilter(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     
     loc_t open1 = find_bof_with_sting_ref("/Applications/Camera.app/", true);
     debug("open1=0x%016llx",open1);
     
-    vmem iter = _vmem->getIter(open1);
+    constexpr uint16_t pachash = ptrauth::string_discriminator("fileglob.fg_ops");
     
-    uint64_t pachash = getPointerAuthStringDiscriminator("fileglob.fg_ops");
-    
-    while (++iter != insn::movk || iter().imm() != pachash << 48)
-        ;
-    
-    loc_t hit = iter;
+    loc_t hit = find_pac_disc_ref(pachash, 0, open1);
+    vmem iter = _vmem->getIter(hit);
     debug("hit=0x%016llx",hit);
     
     while (++iter != insn::pacda)
@@ -749,42 +745,46 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_function_vn_kqfilter(){
     loc_t vnops = find_register_value(iter, iter().rd());
     debug("vnops=0x%016llx",vnops);
     
-    loc_t vn_kqfilter = deref(vnops + 6*8);
-    vn_kqfilter = (vn_kqfilter & 0xffffffff) + find_base();
+    loc_t vn_kqfilter = deref_rebased(vnops + 6*8);
     debug("vn_kqfilter=0x%016llx",vn_kqfilter);
 
-    RETCACHELOC(vn_kqfilter);
+    RETCACHELOC_SYM(vn_kqfilter);
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_cpu_ttep(){
-    UNCACHELOC;
-    vmem iter = _vmem->getIter();
-    while (true) {
-        while (++iter != insn::msr || iter().special() != insn::ttbr1_el1)
-            ;
-        uint8_t reg = iter().rt();
-        if (--iter != insn::ldr || iter().rt() != reg){
-            ++iter;
-            continue;
-        }
-        
-        RETCACHELOC(find_register_value(iter, reg, iter.pc()-0x20));
+    UNCACHELOC_SYM;
+    /*
+     ldr    xN, [xM, cpu_ttep@PAGEOFF]
+     msr    TTBR1_EL1, xN
+     */
+    auto accesses = sysreg_accesses(insn::ttbr1_el1);
+    for (const sysregaccess *a = accesses.first; a != accesses.second; a++) {
+        if (!a->isMSR) continue;
+        vmem iter = _vmem->getIter(a->pc);
+        if (--iter != insn::ldr || iter().rt() != a->rt) continue;
+        RETCACHELOC_SYM(find_register_value(iter, a->rt, iter.pc()-0x20));
     }
-    reterror("Failed to find loc");
+    reterror("Failed to find cpu_ttep");
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_exception_return(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     /*
      exception_return:
      DF 4F 03 D5    msr DAIFSet, #DAIFSC_ALL
      exception_return_unint:
      83 D0 38 D5    mrs x3, TPIDR_EL1
      */
-    loc_t tgt = memmem("\xDF\x4F\x03\xD5\x83\xD0\x38\xD5", 8);
-    debug("tgt=0x%016llx",tgt);
-    assure(tgt);
-    RETCACHELOC(tgt);
+    auto accesses = sysreg_accesses(insn::tpidr_el1);
+    for (const sysregaccess *a = accesses.first; a != accesses.second; a++) {
+        if (a->isMSR || a->rt != 3) continue;
+        vmem iter = _vmem->getIter(a->pc);
+        if ((--iter).opcode() != 0xd5034fdf) continue;
+        loc_t tgt = iter;
+        debug("tgt=0x%016llx",tgt);
+        RETCACHELOC_SYM(tgt);
+    }
+    reterror("Failed to find exception_return");
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_exception_return_after_check(){
@@ -816,24 +816,24 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_gxf_ppl_enter(){
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_kalloc_data_external(){
-    UNCACHELOC;
-    loc_t str = findstr("AMFI: %s: Failed to allocate memory for fatal error message, cannot produce a crash reason", false);
+    UNCACHELOC_SYM;
+    loc_t str = findstr_in_kext(KEXT_AMFI, "AMFI: %s: Failed to allocate memory for fatal error message, cannot produce a crash reason", false);
     debug("str=0x%016llx",str);
     
-    loc_t ref = find_literal_ref(str);
+    loc_t ref = find_literal_ref_in_kext(KEXT_AMFI, str);
     debug("ref=0x%016llx",ref);
     
-    loc_t bref = find_block_branch_ref(ref, -0x100);
+    loc_t bref = branch_into_block(*cfg_for_function(ref), ref);
     debug("bref=0x%016llx",bref);
 
     vmem iter = _vmem->getIter(bref);
     while (--iter != insn::bl)
         ;
-    RETCACHELOC(iter().imm());
+    RETCACHELOC_SYM(iter().imm());
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_kernel_pmap(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     loc_t str = findstr("kaddr not in kernel", false);
     while (deref(str) & 0xff) str--;
     str++;
@@ -845,15 +845,10 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_kernel_pmap(){
     loc_t bof = find_bof(ref);
     debug("bof=0x%016llx",bof);
 
-    uint64_t hash = getPointerAuthStringDiscriminator("_vm_map.pmap");
-    hash<<=48;
+    constexpr uint16_t hash = ptrauth::string_discriminator("_vm_map.pmap");
     
-    vmem iter = _vmem->getIter(bof);
-    
-    while (++iter != insn::movk || iter().imm() != hash)
-        ;
-    
-    loc_t hit = iter;
+    loc_t hit = find_pac_disc_ref(hash, 0, bof);
+    vmem iter = _vmem->getIter(hit);
     debug("hit=0x%016llx",hit);
     while (++iter != insn::autda)
         ;
@@ -871,14 +866,14 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_kernel_pmap(){
     debug("tgtcmp=0x%016llx",tgtcmp);
 
     if (iter().rn() == reg) {
-        RETCACHELOC(find_register_value(iter, iter().rm(), iter.pc()-0x20));
+        RETCACHELOC_SYM(find_register_value(iter, iter().rm(), iter.pc()-0x20));
     }else{
-        RETCACHELOC(find_register_value(iter, iter().rn(), iter.pc()-0x20));
+        RETCACHELOC_SYM(find_register_value(iter, iter().rn(), iter.pc()-0x20));
     }
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ml_sign_thread_state(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     /*
      E1 03 16 AA    mov x1, x22
      E2 03 17 2A    mov w2, w23
@@ -900,11 +895,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ml_sign_thread_state(){
     vmem iter = _vmem->getIter(tgt);
     while (++iter != insn::bl)
         ;
-    RETCACHELOC(iter().imm());
+    RETCACHELOC_SYM(iter().imm());
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_create_options(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     
     loc_t ref = find_literal_ref(0xfeedfacefeedfad3);
     debug("ref=0x%016llx",ref);
@@ -915,7 +910,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_create_options(){
         if (iter() == insn::b) iter = iter().imm()-4;
     }
     
-    RETCACHELOC(iter().imm());
+    RETCACHELOC_SYM(iter().imm());
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_enter_options_addr(){
@@ -927,13 +922,13 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_enter_options_addr(){
     loc_t ref = find_literal_ref(str);
     debug("ref=0x%016llx",ref);
     
-    loc_t bof = find_bof(ref);
+    auto cfg = cfg_for_function(ref);
+    loc_t bof = cfg->funcStart();
     debug("bof=0x%016llx",bof);
     
-    vmem iter = _vmem->getIter(bof);
-    
-    while (++iter != insn::ret)
-        ;
+    auto retBlocks = cfg->ret_blocks();
+    retassure(retBlocks.size(), "Failed to find ret");
+    vmem iter = _vmem->getIter(retBlocks.front()->end);
     
     loc_t ret = iter;
     debug("ret=0x%016llx",ret);
@@ -971,7 +966,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_stub_for_pplcall(uint8_t pp
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_nest(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
 
     loc_t func = find_stub_for_pplcall(0x11);
     debug("func=0x%016llx",func);
@@ -979,11 +974,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_nest(){
     loc_t ref = find_call_ref(func);
     debug("ref=0x%016llx",ref);
 
-    RETCACHELOC(find_bof(ref));
+    RETCACHELOC_SYM(find_bof(ref));
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_remove_options(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
 
     loc_t func = find_stub_for_pplcall(0x17);
     debug("func=0x%016llx",func);
@@ -991,11 +986,11 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_pmap_remove_options(){
     loc_t ref = find_call_ref(func);
     debug("ref=0x%016llx",ref);
 
-    RETCACHELOC(find_bof(ref));
+    RETCACHELOC_SYM(find_bof(ref));
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ppl_bootstrap_dispatch(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     /*
      LEXT(ppl_bootstrap_dispatch)
                     cmp    x15, PMAP_COUNT
@@ -1019,7 +1014,7 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ppl_bootstrap_dispatch(){
         for (int i=0; i<10; i++) {
             if (--iter == insn::cmp){
                 assure(iter().rn() == 15);
-                RETCACHELOC(iter);
+                RETCACHELOC_SYM(iter);
             }
         }
     }
@@ -1027,21 +1022,21 @@ patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ppl_bootstrap_dispatch(){
 }
 
 patchfinder64::loc_t kernelpatchfinder64_iOS16::find_ppl_handler_table(){
-    UNCACHELOC;
+    UNCACHELOC_SYM;
     
     loc_t func = find_ppl_bootstrap_dispatch();
     loc_t retval = 0;
     vmem iter = _vmem->getIter(func);
     
     while (++iter != insn::adrp)
-        if (iter() == insn::adr) RETCACHELOC(iter().imm());
+        if (iter() == insn::adr) RETCACHELOC_SYM(iter().imm());
     
     retval = iter().imm();
     if (++iter == insn::add) {
         retval += iter().imm();
     }
     
-    RETCACHELOC(retval);
+    RETCACHELOC_SYM(retval);
 }
 
 #pragma mark Patch finders
@@ -1129,7 +1124,7 @@ std::vector<patch> kernelpatchfinder64_iOS16::get_codesignature_patches(){
             warning("Failed to get query_trust_cache symbol, ignoring...");
         }else{
             debug("query_trust_cache=0x%016llx",query_trust_cache);
-            loc_t stub_ptr = memmem(&query_trust_cache, sizeof(query_trust_cache));
+            loc_t stub_ptr = find_data_ref(query_trust_cache);
             debug("stub_ptr=0x%016llx",stub_ptr);
             
             loc_t stub_query_trust_cache = find_literal_ref(stub_ptr);
@@ -1323,14 +1318,14 @@ std::vector<patch> kernelpatchfinder64_iOS16::get_mount_patch(){
     UNCACHEPATCHES;
     addPatches(kernelpatchfinder64_iOS15::get_mount_patch());
     
-    loc_t str = findstr("Updating mount to read/write mode is not allowed", false);
+    loc_t str = findstr_in_kext(KEXT_APFS, "Updating mount to read/write mode is not allowed", false);
     if (str) {
         debug("Found 'Updating mount to read/write mode is not allowed' str, adding additional apfs update rw patch");
         while (deref(str) & 0xff) str--;
         str++;
         debug("str=0x%016llx",str);
         
-        loc_t ref = find_literal_ref(str);
+        loc_t ref = find_literal_ref_in_kext(KEXT_APFS, str);
         debug("ref=0x%016llx",ref);
 
         vmem iter = _vmem->getIter(ref);
@@ -1358,10 +1353,10 @@ std::vector<patch> kernelpatchfinder64_iOS16::get_mount_patch(){
 std::vector<patch> kernelpatchfinder64_iOS16::get_apfs_skip_authenticate_root_hash_patch(){
     UNCACHEPATCHES;
     
-    loc_t str = findstr("\"could not authenticate personalized root hash!", false);
+    loc_t str = findstr_in_kext(KEXT_APFS, "\"could not authenticate personalized root hash!", false);
     debug("str=0x%016llx",str);
     
-    loc_t ref = find_literal_ref(str);
+    loc_t ref = find_literal_ref_in_kext(KEXT_APFS, str);
     debug("ref=0x%016llx",ref);
     
     loc_t bof = find_bof(ref);
@@ -1382,24 +1377,15 @@ std::vector<patch> kernelpatchfinder64_iOS16::get_sandbox_patch(){
     }
 
     patchfinder64::loc_t sbops = find_sbops();
-    //pointer now contain linker information :o
-    sbops = (sbops & 0xFFFFFFFF) + _base;
-    
+
     debug("sbobs=0x%016llx",sbops);
     
-    vmem iter = _vmem->getIter();
-        
-    do{
-        ++iter;
-        while (++iter != insn::ret);
-    }while (--iter != insn::movz || iter().rd() != 0 || iter().imm() != 0);
-        
-    patchfinder64::loc_t ret0gadget = iter;
+    patchfinder64::loc_t ret0gadget = find_ret0_gadget();
     debug("ret0gadget=0x%016llx",ret0gadget);
         
 #define PATCH_OP(loc) \
     if (uint64_t origval = deref(loc)) { \
-        patchfinder64::loc_t tmp = ((ret0gadget-_base) & 0xFFFFFFFF) | (origval & 0xFFFFFFFF00000000); \
+        uint64_t tmp = haveRebases() ? encode_rebased(loc, ret0gadget) : ((ret0gadget-_base) & 0xFFFFFFFF) | (origval & 0xFFFFFFFF00000000); \
         patches.push_back({loc,&tmp,sizeof(tmp)}); \
     }
     
@@ -40,7 +40,6 @@ namespace patchfinder {
 
 #pragma mark Location finders
         virtual loc_t find_boot_args_commandline_offset() override;
-        virtual loc_t find_sbops() override;
         virtual loc_t find_cdevsw() override;
         virtual loc_t find_gPhysBase() override;
         virtual loc_t find_gVirtBase() override;
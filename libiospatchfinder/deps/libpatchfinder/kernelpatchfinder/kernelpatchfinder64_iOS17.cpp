@@ -22,10 +22,10 @@ std::vector<patch> kernelpatchfinder64_iOS17::get_codesignature_patches(){
 
     {
         //add disabling launch constraints
-        loc_t str = findstr("AMFI: Validation Category info: current", false);
+        loc_t str = findstr_in_kext(KEXT_AMFI, "AMFI: Validation Category info: current", false);
         debug("str=0x%16llx",str);
 
-        loc_t ref = find_literal_ref(str);
+        loc_t ref = find_literal_ref_in_kext(KEXT_AMFI, str);
         debug("ref=0x%16llx",ref);
         
         loc_t bof = find_bof(ref);
@@ -39,7 +39,7 @@ std::vector<patch> kernelpatchfinder64_iOS17::get_codesignature_patches(){
         //Hello iOS 16.4!
         loc_t query_trust_cache = find_sym("_query_trust_cache");
         debug("query_trust_cache=0x%016llx",query_trust_cache);
-        loc_t stub_ptr = memmem(&query_trust_cache, sizeof(query_trust_cache));
+        loc_t stub_ptr = find_data_ref(query_trust_cache);
         debug("stub_ptr=0x%016llx",stub_ptr);
 
         loc_t stub_query_trust_cache = find_literal_ref(stub_ptr);
@@ -0,0 +1,58 @@
+//
+//  knownsyms64.h
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#ifndef knownsyms64_h
+#define knownsyms64_h
+
+#include <stdint.h>
+
+/*
+    Maps kernel finders (by function name) to the symbols they are looking for.
+    Only list finders whose result is exactly the symbol's address (not a pointer stored there or some offset into it).
+    Entries apply to xnu versions minXnu <= vers < maxXnu (0 means unbounded), symbols are tried in order.
+ */
+struct knownsym64 {
+    const char *finder;
+    uint32_t minXnu;
+    uint32_t maxXnu;
+    const char *syms[3];
+};
+
+static const knownsym64 knownsyms64[] = {
+#pragma mark variables
+    {"find_kerneltask",             0, 0, {"_kernel_task"}},
+    {"find_allproc",                0, 0, {"_allproc"}},
+    {"find_kerncontext",            0, 0, {"_kerncontext"}},
+    {"find_ml_io_map",              0, 0, {"_ml_io_map"}},
+    {"find_kernel_map",             0, 0, {"_kernel_map"}},
+    {"find_cs_blob_generation_count", 0, 0, {"_cs_blob_generation_count"}},
+    {"find_cdevsw",                 0, 0, {"_cdevsw"}},
+    {"find_gPhysBase",              0, 0, {"_gPhysBase"}},
+    {"find_gVirtBase",              0, 0, {"_gVirtBase"}},
+    {"find_ptov_table",             0, 0, {"_ptov_table"}},
+    {"find_vm_pages",               0, 0, {"_vm_pages"}},
+    {"find_vm_first_phys_ppnum",    0, 0, {"_vm_first_phys_ppnum"}},
+    {"find_kernel_pmap",            0, 0, {"_kernel_pmap_store"}},
+    {"find_cpu_ttep",               0, 0, {"_cpu_ttep"}},
+    {"find_ppl_handler_table",      0, 0, {"_ppl_handler_table"}},
+
+#pragma mark functions
+    //since xnu-8792 kmem_free is an inline wrapper, stripped kernels may only carry the _external variant
+    {"find_kmem_free",              0, 8792, {"_kmem_free"}},
+    {"find_kmem_free",           8792, 0, {"_kmem_free", "_kmem_free_external"}},
+    {"find_vnode_getattr",          0, 0, {"_vnode_getattr"}},
+    {"find_kalloc_data_external",   0, 0, {"_kalloc_data_external"}},
+    {"find_ml_sign_thread_state",   0, 0, {"_ml_sign_thread_state"}},
+    {"find_exception_return",       0, 0, {"_exception_return"}},
+    {"find_pmap_create_options",    0, 0, {"_pmap_create_options"}},
+    {"find_pmap_nest",              0, 0, {"_pmap_nest"}},
+    {"find_pmap_remove_options",    0, 0, {"_pmap_remove_options"}},
+    {"find_ppl_bootstrap_dispatch", 0, 0, {"_ppl_bootstrap_dispatch"}},
+    {"find_function_vn_kqfilter",   0, 0, {"_vn_kqfilter"}},
+};
+
+#endif /* knownsyms64_h */
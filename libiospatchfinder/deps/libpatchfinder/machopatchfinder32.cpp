@@ -12,6 +12,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <algorithm>
 
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
@@ -178,27 +179,17 @@ void machopatchfinder32::init(){
             uint32_t filesize = kdata32[2 + 3];
             if (swap) filesize = ntohl(filesize);
 
-            if (!_freeBuf) {
-                //if we don't own the buffer, then we can simply move by the required offset.
-                //a higher level instance will take care of properly freeing the buffer so we can avoid reallocation
-                assure(filesize <= _bufSize - offset);
-                _bufSize = filesize;
-                return (uint8_t*)_buf + offset;
-            }
-
-            uint8_t *ret = (uint8_t*) malloc(filesize);
-            if (ret != NULL) {
-                assure(filesize <= _bufSize - offset);
-                _bufSize = filesize;
-                memcpy(ret, _buf + offset, filesize);
-            }
-            return ret;
+            //no matter if we own the buffer or not, we can simply move by the required offset.
+            //if we own it, remember the offset so that the allocation gets freed properly and we can avoid reallocation
+            assure(offset <= _bufSize && filesize <= _bufSize - offset);
+            _bufSize = filesize;
+            return (uint8_t*)_buf + offset;
         }();
 
         if (tryfat) {
             printf("got fat macho with first slice at %u\n", (uint32_t) (tryfat - _buf));
             if (_freeBuf) {
-                free((void*)_buf);
+                _bufOffset += tryfat - _buf;
             }
             _buf = tryfat;tryfat = NULL;
         } else {
@@ -214,7 +205,8 @@ void machopatchfinder32::init(){
 
 machopatchfinder32::machopatchfinder32(const char *filename) :
     patchfinder32(true),
-    __symtab(NULL)
+    __symtab(NULL),
+    __symIndexLoaded(false)
 {
     struct stat fs = {0};
     int fd = 0;
@@ -224,7 +216,8 @@ machopatchfinder32::machopatchfinder32(const char *filename) :
 #endif //HAVE_IMG4TOOL
     cleanup([&]{
         if (fd>0) close(fd);
-        if (!didConstructSuccessfully) {
+        if (!didConstructSuccessfully && _buf) {
+            _buf -= _bufOffset; _bufOffset = 0;
             safeFreeConst(_buf);
         }
 #ifdef HAVE_IMG4TOOL
@@ -252,13 +245,11 @@ machopatchfinder32::machopatchfinder32(const char *filename) :
             *img4tmp = img4tool::getIM4PFromIMG4(*img4tmp);
         }
         if (img4tool::isIM4P(*img4tmp)) {
-            *img4tmp = img4tool::getPayloadFromIM4P(*img4tmp);
-            
-            assure(img4tmp->ownsBuffer());
-            free((void*)_buf);
-            
-            assure(_buf = (uint8_t*)malloc(_bufSize = img4tmp->payloadSize()));
-            memcpy((void*)_buf, img4tmp->payload(), _bufSize);
+            //img4tmp holds its own copy, so drop the file before we unpack
+            safeFreeConst(_buf);
+            //payload gets decompressed straight into the buffer we adopt, no need for another full-size copy
+            assure(_buf = (uint8_t*)img4tool::getRawPayloadFromIM4P(*img4tmp, &_bufSize));
+            safeDelete(img4tmp);
         }
     }
 #else
@@ -289,7 +280,8 @@ machopatchfinder32::machopatchfinder32(const char *filename) :
 
 machopatchfinder32::machopatchfinder32(const void *buffer, size_t bufSize, bool takeOwnership) :
 patchfinder32(takeOwnership),
-__symtab(NULL)
+__symtab(NULL),
+__symIndexLoaded(false)
 {
     _bufSize = bufSize;
     _buf = (uint8_t*)buffer;
@@ -298,37 +290,67 @@ __symtab(NULL)
 
 machopatchfinder32::machopatchfinder32(machopatchfinder32 &&mv)
 : patchfinder32(std::move(mv)),
-__symtab(mv.__symtab)
+__symtab(mv.__symtab),
+__symsByName(std::move(mv.__symsByName)),
+__symsByAddr(std::move(mv.__symsByAddr)),
+__symIndexLoaded(mv.__symIndexLoaded)
 {
     _bufSize = mv._bufSize;
     _buf = mv._buf;
 }
 
-patchfinder32::loc_t machopatchfinder32::find_sym(const char *sym){
+void machopatchfinder32::loadSymIndex(){
+    if (__symIndexLoaded) return;
     const uint8_t *psymtab = _buf + getSymtab()->symoff;
     const uint8_t *pstrtab = _buf + getSymtab()->stroff;
 
     struct nlist *entry = (struct nlist *)psymtab;
-    for (uint32_t i = 0; i < getSymtab()->nsyms; i++, entry++)
-        if (!strcmp(sym, (char*)(pstrtab + entry->n_un.n_strx)))
-            return (loc_t)entry->n_value;
+    for (uint32_t i = 0; i < getSymtab()->nsyms; i++, entry++){
+        const char *stab_sym = (const char*)(pstrtab + entry->n_un.n_strx);
+        //first definition wins, same as the linear search did
+        __symsByName.emplace(stab_sym, (loc_t)entry->n_value);
+        __symsByAddr.push_back({(loc_t)entry->n_value, stab_sym, !(entry->n_type & N_STAB) && (entry->n_type & N_TYPE) == N_SECT});
+    }
+    std::stable_sort(__symsByAddr.begin(), __symsByAddr.end(), [](const symaddr &a, const symaddr &b){
+        return a.addr < b.addr;
+    });
+    __symIndexLoaded = true;
+}
+
+patchfinder32::loc_t machopatchfinder32::find_sym(const char *sym){
+    loadSymIndex();
+    auto e = __symsByName.find(sym);
+    if (e != __symsByName.end()) return e->second;
 
     retcustomerror(symbol_not_found,sym);
 }
 
 std::string machopatchfinder32::sym_for_addr(loc_t addr){
-    const uint8_t *psymtab = _buf + getSymtab()->symoff;
-    const uint8_t *pstrtab = _buf + getSymtab()->stroff;
-
-    struct nlist *entry = (struct nlist *)psymtab;
-    for (uint32_t i = 0; i < getSymtab()->nsyms; i++, entry++)
-        if (addr == (loc_t)entry->n_value) {
-            return (const char*)(pstrtab + entry->n_un.n_strx);
-        }
+    loadSymIndex();
+    auto e = std::lower_bound(__symsByAddr.begin(), __symsByAddr.end(), addr, [](const symaddr &a, loc_t addr){
+        return a.addr < addr;
+    });
+    if (e != __symsByAddr.end() && e->addr == addr) return e->name;
 
     retcustomerror(symbol_not_found,"No symbol for address=0x%08x",addr);
 }
 
+std::pair<std::string,uint32_t> machopatchfinder32::symbolicate(loc_t addr){
+    loadSymIndex();
+    auto e = std::upper_bound(__symsByAddr.begin(), __symsByAddr.end(), addr, [](loc_t addr, const symaddr &a){
+        return addr < a.addr;
+    });
+    while (e != __symsByAddr.begin()) {
+        --e;
+        if (!e->isDefined) continue;
+        //prefer the first one of several symbols at the same address
+        while (e != __symsByAddr.begin() && (e-1)->addr == e->addr && (e-1)->isDefined) --e;
+        return {e->name, addr - e->addr};
+    }
+
+    retcustomerror(symbol_not_found,"No symbol at or below address=0x%08x",addr);
+}
+
 machopatchfinder32::loc_t machopatchfinder32::bl_jump_stub_ptr_loc(loc_t bl_insn){
     vmem_thumb iter = _vmemThumb->getIter(bl_insn);
     assure(iter() == arm32::bl);
@@ -12,7 +12,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <string.h>
+#include <algorithm>
 
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
@@ -22,12 +24,15 @@
 
 #include <mach-o/loader.h>
 #include <mach-o/nlist.h>
+#include <mach-o/fixup-chains.h>
 
 #ifdef HAVE_IMG4TOOL
 #include <img4tool/img4tool.hpp>
 #endif //HAVE_IMG4TOOL
 
 #include "../include/libpatchfinder/machopatchfinder64.hpp"
+#include "../include/libpatchfinder/emu64.hpp"
+#include "../include/libpatchfinder/payloadcache.hpp"
 
 using namespace tihmstar::patchfinder;
 using namespace tihmstar::libinsn;
@@ -64,6 +69,67 @@ __attribute__((always_inline)) struct section_64 *find_section(struct segment_co
     return NULL;
 }
 
+/*
+    Decodes a single fixup chain starting at buf (which has size bytes left in its segment) into rebases.
+    format 0 is the pre-fileset __thread_starts encoding, which is arm64e with unslid addresses in non-auth pointers.
+ */
+static void walkFixupChain(std::vector<machopatchfinder64::rebase> &rebases, const uint8_t *buf, size_t size, uint64_t vaddr, uint8_t format, uint32_t stride, uint64_t base){
+    for (size_t off = 0;;) {
+        retassure(off + sizeof(uint64_t) <= size, "fixup chain runs out of segment at 0x%016llx",vaddr+off);
+        uint64_t raw = *(const uint64_t*)(buf+off);
+        machopatchfinder64::rebase r = {vaddr+off};
+        uint64_t next = 0;
+        bool isBind = false;
+        switch (format) {
+            case 0:
+            case DYLD_CHAINED_PTR_ARM64E:
+            case DYLD_CHAINED_PTR_ARM64E_KERNEL:
+            case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+                next = (raw >> 51) & 0x7ff;
+                isBind = (raw >> 62) & 1;
+                r.isAuth = (raw >> 63) & 1;
+                if (r.isAuth) {
+                    r.target = base + (raw & 0xffffffff);
+                    r.diversity = (raw >> 32) & 0xffff;
+                    r.addrDiv = (raw >> 48) & 1;
+                    r.key = (raw >> 49) & 3;
+                }else{
+                    uint64_t high8 = (raw >> 43) & 0xff;
+                    r.target = raw & 0x7ffffffffff;
+                    if (format == 0 || format == DYLD_CHAINED_PTR_ARM64E) {
+                        r.target = (uint64_t)(((int64_t)r.target << 21) >> 21); //sign extend
+                    }else{
+                        r.target += base;
+                    }
+                    if (high8) r.target = (r.target & 0x00ffffffffffffff) | (high8 << 56);
+                }
+                break;
+            case DYLD_CHAINED_PTR_64_KERNEL_CACHE:
+                next = (raw >> 51) & 0xfff;
+                r.isAuth = (raw >> 63) & 1;
+                r.target = base + (raw & 0x3fffffff);
+                r.diversity = (raw >> 32) & 0xffff;
+                r.addrDiv = (raw >> 48) & 1;
+                r.key = (raw >> 49) & 3;
+                break;
+            case DYLD_CHAINED_PTR_64:
+            case DYLD_CHAINED_PTR_64_OFFSET:
+                next = (raw >> 51) & 0xfff;
+                isBind = (raw >> 63) & 1;
+                r.target = raw & 0xfffffffff;
+                if (format == DYLD_CHAINED_PTR_64_OFFSET) r.target += base;
+                r.target |= ((raw >> 36) & 0xff) << 56;
+                break;
+            default:
+                reterror("unsupported fixup pointer format %d",format);
+        }
+        r.format = format;
+        if (!isBind) rebases.push_back(r); //kernelcaches have no imports
+        if (!next) break;
+        off += next * stride;
+    }
+}
+
 #pragma mark macho local
 
 __attribute__((always_inline)) const std::vector<std::pair<const struct symtab_command *,uint8_t *>> &machopatchfinder64::getSymtabs(){
@@ -71,7 +137,20 @@ __attribute__((always_inline)) const std::vector<std::pair<const struct symtab_c
     return __symtabs;
 }
 
-std::vector<vsegment> machopatchfinder64::loadSegmentsForMachHeader(void *mh){
+void machopatchfinder64::loadSectionsForSegment(const void *seg_, const char *bundleID){
+    const struct segment_command_64 *seg = (const struct segment_command_64 *)seg_;
+    const struct section_64 *sect = (const struct section_64 *)(seg + 1);
+    for (uint32_t i=0; i<seg->nsects; i++, sect++) {
+        uint32_t type = sect->flags & SECTION_TYPE;
+        if (!sect->size || type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL) continue;
+        __sections.push_back({_buf+sect->offset, sect->size, (patchfinder64::loc_t)sect->addr, (vmprot)seg->maxprot, type,
+            std::string(sect->segname,strnlen(sect->segname,sizeof(sect->segname))),
+            std::string(sect->sectname,strnlen(sect->sectname,sizeof(sect->sectname))),
+            bundleID ? bundleID : ""});
+    }
+}
+
+std::vector<vsegment> machopatchfinder64::loadSegmentsForMachHeader(void *mh, const char *bundleID){
     std::vector<vsegment> segments;
     struct mach_header_64 *mhr = (struct mach_header_64*)mh;
     struct load_command *lcmd = (struct load_command *)(mhr + 1);
@@ -90,6 +169,7 @@ std::vector<vsegment> machopatchfinder64::loadSegmentsForMachHeader(void *mh){
             bool isWeirdPrelinkText = (strcmp(seg->segname, "__PRELINK_TEXT") == 0 && seg->maxprot == (kVMPROTREAD | kVMPROTWRITE));
             if (strcmp(seg->segname, "__TEXT_EXEC") == 0) has_text_exec = true;
             segments.push_back({_buf+seg->fileoff,seg->filesize, seg->vmaddr, (vmprot)(isWeirdPrelinkText ? (kVMPROTEXEC | kVMPROTREAD) : seg->maxprot), seg->segname});
+            loadSectionsForSegment(seg, bundleID);
         }
     }
     return segments;
@@ -116,6 +196,7 @@ void machopatchfinder64::loadSegments(){
             bool isWeirdPrelinkText = (strcmp(seg->segname, "__PRELINK_TEXT") == 0 && seg->maxprot == (kVMPROTREAD | kVMPROTWRITE));
             if (strcmp(seg->segname, "__TEXT_EXEC") == 0) has_text_exec = true;
             segments.push_back({_buf+seg->fileoff,seg->filesize, (patchfinder64::loc_t)seg->vmaddr, (vmprot)(isWeirdPrelinkText ? (kVMPROTEXEC | kVMPROTREAD) : seg->maxprot), seg->segname});
+            loadSectionsForSegment(seg, NULL);
             if (!_base){
                 _base = (patchfinder64::loc_t)seg->vmaddr; //first segment is base. Is this correct??
             }
@@ -144,8 +225,10 @@ void machopatchfinder64::loadSegments(){
             } catch (tihmstar::load_command_not_found &e) {
                 //
             }
-            auto s = loadSegmentsForMachHeader(header);
+            const char *bundleID = (const char*)fe + fe->entry_id.offset;
+            auto s = loadSegmentsForMachHeader(header, bundleID);
             segments2.insert(segments2.end(), s.begin(), s.end());
+            __kextSegments[bundleID] = s;
         }
     }
     try {
@@ -154,7 +237,13 @@ void machopatchfinder64::loadSegments(){
     } catch (tihmstar::load_command_not_found &e) {
         //
     }
-    if (segments2.size()) segments = segments2;
+    if (segments2.size()) {
+        segments = segments2;
+        //the fileset's own segments only span the kexts, their sections are what we got from the entries
+        __sections.erase(std::remove_if(__sections.begin(), __sections.end(), [](const vsection &s){
+            return s.bundleID.empty();
+        }), __sections.end());
+    }
     
     if (has_text_exec) {
         warning("We encountered __TEXT_EXEC section, marking normal __TEXT section as non-executable!");
@@ -165,6 +254,14 @@ void machopatchfinder64::loadSegments(){
             newsegments.push_back({seg.buf,seg.size,seg.vaddr, (vmprot)prot, seg.segname});
         }
         segments = newsegments;
+        for (auto &kext : __kextSegments) {
+            for (auto &seg : kext.second) {
+                if (seg.segname == "__TEXT") seg.perms = (vmprot)(seg.perms & ~kVMPROTEXEC);
+            }
+        }
+        for (auto &sect : __sections) {
+            if (sect.segname == "__TEXT") sect.perms = (vmprot)(sect.perms & ~kVMPROTEXEC);
+        }
     }
     _vmem = new vmem(segments,0,kVMPROTALL);
     
@@ -208,27 +305,17 @@ void machopatchfinder64::init(){
             uint32_t filesize = kdata32[2 + 3];
             if (swap) filesize = ntohl(filesize);
     
-            if (!_freeBuf) {
-                //if we don't own the buffer, then we can simply move by the required offset.
-                //a higher level instance will take care of properly freeing the buffer so we can avoid reallocation
-                assure(filesize <= _bufSize - offset);
-                _bufSize = filesize;
-                return (uint8_t*)_buf + offset;
-            }
-            
-            uint8_t *ret = (uint8_t*) malloc(filesize);
-            if (ret != NULL) {
-                assure(filesize <= _bufSize - offset);
-                _bufSize = filesize;
-                memcpy(ret, _buf + offset, filesize);
-            }
-            return ret;
+            //no matter if we own the buffer or not, we can simply move by the required offset.
+            //if we own it, remember the offset so that the allocation gets freed properly and we can avoid reallocation
+            assure(offset <= _bufSize && filesize <= _bufSize - offset);
+            _bufSize = filesize;
+            return (uint8_t*)_buf + offset;
         }();
     
         if (tryfat) {
             printf("got fat macho with first slice at %u\n", (uint32_t) (tryfat - _buf));
             if (_freeBuf) {
-                free((void*)_buf);
+                _bufOffset += tryfat - _buf;
             }
             _buf = tryfat;tryfat = NULL;
         } else {
@@ -243,7 +330,9 @@ void machopatchfinder64::init(){
 
 
 machopatchfinder64::machopatchfinder64(const char *filename) :
-    patchfinder64(true)
+    patchfinder64(true),
+    __symIndexLoaded(false),
+    __rebasesLoaded(false)
 {
     struct stat fs = {0};
     int fd = 0;
@@ -253,7 +342,11 @@ machopatchfinder64::machopatchfinder64(const char *filename) :
 #endif //HAVE_IMG4TOOL
     cleanup([&]{
         if (fd>0) close(fd);
-        if (!didConstructSuccessfully) {
+        if (!didConstructSuccessfully && _buf) {
+            _buf -= _bufOffset; _bufOffset = 0;
+            if (_bufMapSize) {
+                munmap((void*)_buf, _bufMapSize); _buf = NULL; _bufMapSize = 0;
+            }
             safeFreeConst(_buf);
         }
 #ifdef HAVE_IMG4TOOL
@@ -281,13 +374,30 @@ machopatchfinder64::machopatchfinder64(const char *filename) :
             *img4tmp = img4tool::getIM4PFromIMG4(*img4tmp);
         }
         if (img4tool::isIM4P(*img4tmp)) {
-            *img4tmp = img4tool::getPayloadFromIM4P(*img4tmp);
-            
-            assure(img4tmp->ownsBuffer());
-            free((void*)_buf);
-            
-            assure(_buf = (uint8_t*)malloc(_bufSize = img4tmp->payloadSize()));
-            memcpy((void*)_buf, img4tmp->payload(), _bufSize);
+            payloadcache cache(getenv(PAYLOADCACHE_DIR_ENV));
+            std::string cacheKey;
+            //img4tmp holds its own copy, so drop the file before we unpack
+            safeFreeConst(_buf);
+            if (cache.isEnabled()) {
+                size_t mappedSize = 0;
+                cacheKey = payloadcache::keyForBuffer(img4tmp->buf(), img4tmp->size());
+                if (const void *mapped = cache.map(cacheKey, &mappedSize)) {
+                    uint32_t magic = *(uint32_t*)mapped;
+                    if (magic == 0xfeedfacf || magic == 0xbebafeca || magic == 0xcafebabe) {
+                        _buf = (const uint8_t *)mapped;
+                        _bufSize = _bufMapSize = mappedSize;
+                    }else{
+                        warning("Ignoring bad cache entry %s",cacheKey.c_str());
+                        munmap((void*)mapped, mappedSize);
+                    }
+                }
+            }
+            if (!_buf) {
+                //payload gets decompressed straight into the buffer we adopt, no need for another full-size copy
+                assure(_buf = (uint8_t*)img4tool::getRawPayloadFromIM4P(*img4tmp, &_bufSize));
+                cache.store(cacheKey, _buf, _bufSize);
+            }
+            safeDelete(img4tmp);
         }
     }
 #else
@@ -300,7 +410,9 @@ machopatchfinder64::machopatchfinder64(const char *filename) :
 }
 
 machopatchfinder64::machopatchfinder64(const void *buffer, size_t bufSize, bool takeOwnership) :
-patchfinder64(takeOwnership)
+patchfinder64(takeOwnership),
+__symIndexLoaded(false),
+__rebasesLoaded(false)
 {
     _bufSize = bufSize;
     _buf = (uint8_t*)buffer;
@@ -309,43 +421,76 @@ patchfinder64(takeOwnership)
 
 machopatchfinder64::machopatchfinder64(machopatchfinder64 &&mv)
 : patchfinder64(std::move(mv)),
-__symtabs(mv.__symtabs)
+__symtabs(mv.__symtabs),
+__symsByName(std::move(mv.__symsByName)),
+__symsByAddr(std::move(mv.__symsByAddr)),
+__symIndexLoaded(mv.__symIndexLoaded),
+__kextSegments(std::move(mv.__kextSegments)),
+__kextVmems(std::move(mv.__kextVmems)),
+__sections(std::move(mv.__sections)),
+__sectionVmems(std::move(mv.__sectionVmems)),
+__rebases(std::move(mv.__rebases)),
+__rebasesByTarget(std::move(mv.__rebasesByTarget)),
+__rebasesLoaded(mv.__rebasesLoaded)
 {
     _bufSize = mv._bufSize;
     _buf = mv._buf;
 }
 
-patchfinder64::loc_t machopatchfinder64::find_sym(const char *sym){
+void machopatchfinder64::loadSymIndex(){
+    if (__symIndexLoaded) return;
     for (auto symtab : getSymtabs()){
         const uint8_t *psymtab = _buf + symtab.first->symoff;
         const uint8_t *pstrtab = _buf + symtab.first->stroff;
         
         struct nlist_64 *entry = (struct nlist_64 *)psymtab;
         for (uint32_t i = 0; i < symtab.first->nsyms; i++, entry++){
-            char *stab_sym = (char*)(pstrtab + entry->n_un.n_strx);
-            if (!strcmp(sym, stab_sym)){
-                return (patchfinder64::loc_t)entry->n_value;
-            }
+            const char *stab_sym = (const char*)(pstrtab + entry->n_un.n_strx);
+            //first definition wins, same as the linear search did
+            __symsByName.emplace(stab_sym, (loc_t)entry->n_value);
+            __symsByAddr.push_back({(loc_t)entry->n_value, stab_sym, !(entry->n_type & N_STAB) && (entry->n_type & N_TYPE) == N_SECT});
         }
     }
-    
+    std::stable_sort(__symsByAddr.begin(), __symsByAddr.end(), [](const symaddr &a, const symaddr &b){
+        return a.addr < b.addr;
+    });
+    __symIndexLoaded = true;
+}
+
+patchfinder64::loc_t machopatchfinder64::find_sym(const char *sym){
+    loadSymIndex();
+    auto e = __symsByName.find(sym);
+    if (e != __symsByName.end()) return e->second;
+
     retcustomerror(symbol_not_found,sym);
 }
 
 std::string machopatchfinder64::sym_for_addr(patchfinder64::loc_t addr){
-    for (auto symtab : getSymtabs()){
-        const uint8_t *psymtab = _buf + symtab.first->symoff;
-        const uint8_t *pstrtab = _buf + symtab.first->stroff;
-        
-        struct nlist_64 *entry = (struct nlist_64 *)psymtab;
-        for (uint32_t i = 0; i < symtab.first->nsyms; i++, entry++)
-            if (addr == (patchfinder64::loc_t)entry->n_value)
-                return (const char*)(pstrtab + entry->n_un.n_strx);
-    }
+    loadSymIndex();
+    auto e = std::lower_bound(__symsByAddr.begin(), __symsByAddr.end(), addr, [](const symaddr &a, loc_t addr){
+        return a.addr < addr;
+    });
+    if (e != __symsByAddr.end() && e->addr == addr) return e->name;
 
     retcustomerror(symbol_not_found,"No symbol for address=0x%016llx",addr);
 }
 
+std::pair<std::string,uint64_t> machopatchfinder64::symbolicate(patchfinder64::loc_t addr){
+    loadSymIndex();
+    auto e = std::upper_bound(__symsByAddr.begin(), __symsByAddr.end(), addr, [](loc_t addr, const symaddr &a){
+        return addr < a.addr;
+    });
+    while (e != __symsByAddr.begin()) {
+        --e;
+        if (!e->isDefined) continue;
+        //prefer the first one of several symbols at the same address
+        while (e != __symsByAddr.begin() && (e-1)->addr == e->addr && (e-1)->isDefined) --e;
+        return {e->name, addr - e->addr};
+    }
+
+    retcustomerror(symbol_not_found,"No symbol at or below address=0x%016llx",addr);
+}
+
 patchfinder64::loc_t machopatchfinder64::bl_jump_stub_ptr_loc(patchfinder64::loc_t bl_insn){
     vmem iter = _vmem->getIter(bl_insn);
     assure(iter() == insn::bl);
@@ -358,3 +503,218 @@ patchfinder64::loc_t machopatchfinder64::bl_jump_stub_ptr_loc(patchfinder64::loc
     }
     return (patchfinder64::loc_t)iter().imm() + ldr().imm();
 }
+
+#pragma mark kexts
+const patchfinder64::vmem *machopatchfinder64::vmem_for_kext(const char *bundleID){
+    auto v = __kextVmems.find(bundleID);
+    if (v != __kextVmems.end()) return v->second.get();
+
+    auto segs = __kextSegments.find(bundleID);
+    if (segs == __kextSegments.end()) {
+        debug("kext '%s' not found, using whole kernel",bundleID);
+        return _vmem;
+    }
+    const vmem *ret = new vmem(segs->second);
+    __kextVmems[bundleID].reset(ret);
+    return ret;
+}
+
+bool machopatchfinder64::haveKext(const char *bundleID) noexcept{
+    return __kextSegments.find(bundleID) != __kextSegments.end();
+}
+
+patchfinder64::loc_t machopatchfinder64::findstr_in_kext(const char *bundleID, std::string str, bool hasNullTerminator, loc_t startAddr){
+    return memmem_in_kext(bundleID, str.c_str(), str.size()+(hasNullTerminator), startAddr);
+}
+
+patchfinder64::loc_t machopatchfinder64::find_literal_ref_in_kext(const char *bundleID, loc_t pos, int ignoreTimes, loc_t startPos){
+    return find_literal_ref_in_vmem(vmem_for_kext(bundleID), pos, ignoreTimes, startPos);
+}
+
+patchfinder64::loc_t machopatchfinder64::memmem_in_kext(const char *bundleID, const void *little, size_t little_len, loc_t startLoc){
+    return vmem_for_kext(bundleID)->memmem(little, little_len, startLoc);
+}
+
+#pragma mark sections
+const patchfinder64::vmem *machopatchfinder64::vmem_for_section(const char *sectname, const char *segname, const char *bundleID){
+    std::string key = sectname;
+    key += ',';
+    if (segname) key += segname;
+    key += ',';
+    if (bundleID) key += bundleID;
+
+    auto v = __sectionVmems.find(key);
+    if (v != __sectionVmems.end()) return v->second.get();
+
+    std::vector<vsegment> segments;
+    for (auto &sect : __sections) {
+        if (sect.sectname != sectname) continue;
+        if (segname && sect.segname != segname) continue;
+        if (bundleID && sect.bundleID != bundleID) continue;
+        segments.push_back({sect.buf, sect.size, sect.vaddr, sect.perms, sect.segname});
+    }
+    if (!segments.size()) {
+        debug("section '%s' not found, using whole kernel",key.c_str());
+        return _vmem;
+    }
+    const vmem *ret = new vmem(segments);
+    __sectionVmems[key].reset(ret);
+    return ret;
+}
+
+patchfinder64::loc_t machopatchfinder64::findstr_in_section(const char *sectname, std::string str, bool hasNullTerminator, loc_t startAddr){
+    return vmem_for_section(sectname)->memmem(str.c_str(), str.size()+(hasNullTerminator), startAddr);
+}
+
+#pragma mark fixups
+void machopatchfinder64::loadChainedFixups(std::vector<rebase> &rebases){
+    struct mach_header_64 *mh = (struct mach_header_64*)_buf;
+    struct load_command *lcmd = (struct load_command *)(mh + 1);
+    const struct linkedit_data_command *fixups = NULL;
+    std::vector<const struct segment_command_64 *> segs; //chain starts refer to segments by index
+    for (uint32_t i=0; i<mh->ncmds; i++, lcmd = (struct load_command *)((uint8_t *)lcmd + lcmd->cmdsize)) {
+        if (lcmd->cmd == LC_SEGMENT_64) segs.push_back((const struct segment_command_64 *)lcmd);
+        else if (lcmd->cmd == LC_DYLD_CHAINED_FIXUPS) fixups = (const struct linkedit_data_command *)lcmd;
+    }
+    if (!fixups) return;
+    retassure((uint64_t)fixups->dataoff + fixups->datasize <= _bufSize, "chained fixups out of bounds");
+
+    const uint8_t *fbuf = _buf + fixups->dataoff;
+    auto header = (const struct dyld_chained_fixups_header *)fbuf;
+    auto starts = (const struct dyld_chained_starts_in_image *)(fbuf + header->starts_offset);
+    for (uint32_t s=0; s<starts->seg_count && s<segs.size(); s++) {
+        if (!starts->seg_info_offset[s]) continue;
+        auto segstarts = (const struct dyld_chained_starts_in_segment *)((const uint8_t*)starts + starts->seg_info_offset[s]);
+        const struct segment_command_64 *seg = segs[s];
+        uint32_t stride = (segstarts->pointer_format == DYLD_CHAINED_PTR_ARM64E || segstarts->pointer_format == DYLD_CHAINED_PTR_ARM64E_USERLAND) ? 8 : 4;
+        for (uint16_t p=0; p<segstarts->page_count; p++) {
+            uint16_t start = segstarts->page_start[p];
+            if (start == DYLD_CHAINED_PTR_START_NONE) continue;
+            retassure(!(start & DYLD_CHAINED_PTR_START_MULTI), "multiple chain starts per page are not supported");
+            uint64_t off = (uint64_t)p*segstarts->page_size + start;
+            retassure(off < seg->filesize, "chain start out of segment");
+            walkFixupChain(rebases, _buf+seg->fileoff+off, seg->filesize-off, seg->vmaddr+off, (uint8_t)segstarts->pointer_format, stride, _base);
+        }
+    }
+}
+
+void machopatchfinder64::loadThreadStarts(std::vector<rebase> &rebases){
+    const vsection *threadStarts = NULL;
+    for (auto &sect : __sections) {
+        if (sect.sectname == "__thread_starts") {
+            threadStarts = &sect;
+            break;
+        }
+    }
+    if (!threadStarts || threadStarts->size < sizeof(uint32_t)) return;
+
+    const uint32_t *starts = (const uint32_t *)threadStarts->buf;
+    const uint32_t *startsEnd = starts + threadStarts->size/sizeof(uint32_t);
+    uint32_t stride = (*starts++ & 1) ? 8 : 4;
+    std::vector<vsegment> segments = _vmem->getSegments();
+    for (; starts < startsEnd && *starts != 0xffffffff; starts++) {
+        loc_t vaddr = _base + *starts;
+        for (auto &seg : segments) {
+            if (vaddr < seg.vaddr || vaddr >= seg.vaddr + seg.size) continue;
+            walkFixupChain(rebases, seg.buf + (vaddr - seg.vaddr), seg.size - (vaddr - seg.vaddr), vaddr, 0, stride, _base);
+            break;
+        }
+    }
+}
+
+void machopatchfinder64::loadRebases(){
+    if (__rebasesLoaded) return;
+    //decode into a local table, so a chain failing halfway doesn't leave a partial one behind
+    std::vector<rebase> rebases;
+    loadChainedFixups(rebases);
+    if (!rebases.size()) loadThreadStarts(rebases);
+
+    std::sort(rebases.begin(), rebases.end(), [](const rebase &a, const rebase &b){
+        return a.slot < b.slot;
+    });
+    std::vector<uint32_t> byTarget(rebases.size());
+    for (uint32_t i=0; i<rebases.size(); i++) byTarget[i] = i;
+    std::sort(byTarget.begin(), byTarget.end(), [&rebases](uint32_t a, uint32_t b){
+        return rebases[a].target < rebases[b].target;
+    });
+    __rebases.swap(rebases);
+    __rebasesByTarget.swap(byTarget);
+    debug("decoded %zu rebased pointers",__rebases.size());
+    __rebasesLoaded = true;
+}
+
+emu64 machopatchfinder64::emulator(const vmem *mem, loc_t pc){
+    //fixups only get decoded once the emulator actually loads a pointer
+    return emu64(mem, pc, [this](loc_t slot, uint64_t raw)->uint64_t{
+        const rebase *r = rebase_for_loc(slot);
+        return r ? r->target : raw;
+    });
+}
+
+void machopatchfinder64::loadDataRefs(){
+    for (auto &seg : _vmem->getSegments()) {
+        if (seg.perms & kVMPROTEXEC) continue;
+        if (seg.segname == "__LINKEDIT") continue; //don't pick up symbol values
+        addDataRefsForSegment(seg);
+    }
+    //chained pointers don't hold their target as is, add them with the decoded one
+    loadRebases();
+    for (auto &r : __rebases) {
+        _dataRefs.push_back({r.target,r.slot});
+    }
+}
+
+bool machopatchfinder64::haveRebases(){
+    loadRebases();
+    return __rebases.size();
+}
+
+const machopatchfinder64::rebase *machopatchfinder64::rebase_for_loc(loc_t slot){
+    loadRebases();
+    auto e = std::lower_bound(__rebases.begin(), __rebases.end(), slot, [](const rebase &a, loc_t slot){
+        return a.slot < slot;
+    });
+    if (e != __rebases.end() && e->slot == slot) return &*e;
+    return NULL;
+}
+
+patchfinder64::loc_t machopatchfinder64::deref_rebased(loc_t pos){
+    if (const rebase *r = rebase_for_loc(pos)) return r->target;
+    return deref(pos);
+}
+
+std::vector<patchfinder64::loc_t> machopatchfinder64::find_rebased_ptr_refs(loc_t target){
+    loadRebases();
+    std::vector<loc_t> ret;
+    auto e = std::lower_bound(__rebasesByTarget.begin(), __rebasesByTarget.end(), target, [this](uint32_t i, loc_t target){
+        return __rebases[i].target < target;
+    });
+    for (; e != __rebasesByTarget.end() && __rebases[*e].target == target; e++) {
+        ret.push_back(__rebases[*e].slot);
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+uint64_t machopatchfinder64::encode_rebased(loc_t slot, loc_t target){
+    const rebase *r = rebase_for_loc(slot);
+    if (!r) return target;
+    uint64_t raw = deref(slot);
+    switch (r->format) {
+        case 0:
+        case DYLD_CHAINED_PTR_ARM64E:
+        case DYLD_CHAINED_PTR_ARM64E_KERNEL:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+            if (r->isAuth) return (raw & ~0xffffffffULL) | ((target - _base) & 0xffffffff);
+            if (r->format == 0 || r->format == DYLD_CHAINED_PTR_ARM64E) return (raw & ~0x7ffffffffffULL) | (target & 0x7ffffffffffULL);
+            return (raw & ~0x7ffffffffffULL) | ((target - _base) & 0x7ffffffffffULL);
+        case DYLD_CHAINED_PTR_64_KERNEL_CACHE:
+            return (raw & ~0x3fffffffULL) | ((target - _base) & 0x3fffffff);
+        case DYLD_CHAINED_PTR_64:
+            return (raw & ~0xfffffffffULL) | (target & 0xfffffffffULL);
+        case DYLD_CHAINED_PTR_64_OFFSET:
+            return (raw & ~0xfffffffffULL) | ((target - _base) & 0xfffffffffULL);
+        default:
+            reterror("unsupported fixup pointer format %d",r->format);
+    }
+}
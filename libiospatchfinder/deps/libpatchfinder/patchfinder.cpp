@@ -7,6 +7,7 @@
 
 #include "../include/libpatchfinder/patchfinder.hpp"
 #include <libgeneral/macros.h>
+#include <sys/mman.h>
 
 using namespace tihmstar::patchfinder;
 
@@ -16,6 +17,8 @@ patchfinder::patchfinder(bool freeBuf) :
     _freeBuf(freeBuf),
     _buf(NULL),
     _bufSize(0),
+    _bufOffset(0),
+    _bufMapSize(0),
     _entrypoint(0),
     _base(0)
 {
@@ -26,6 +29,8 @@ patchfinder::patchfinder(tihmstar::patchfinder::patchfinder &&mv) :
     _freeBuf(mv._freeBuf),
     _buf(mv._buf),
     _bufSize(mv._bufSize),
+    _bufOffset(mv._bufOffset),
+    _bufMapSize(mv._bufMapSize),
     _entrypoint(mv._entrypoint),
     _base(mv._base)
 {
@@ -33,7 +38,14 @@ patchfinder::patchfinder(tihmstar::patchfinder::patchfinder &&mv) :
 }
 
 patchfinder::~patchfinder(){
-    if (_freeBuf) safeFreeConst(_buf);
+    if (_freeBuf && _buf) {
+        _buf -= _bufOffset;
+        if (_bufMapSize) {
+            munmap((void*)_buf, _bufMapSize); _buf = NULL;
+        }else{
+            safeFreeConst(_buf);
+        }
+    }
 }
 
 const void *patchfinder::buf() {
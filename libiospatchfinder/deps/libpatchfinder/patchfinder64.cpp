@@ -9,13 +9,17 @@
 #include <libgeneral/macros.h>
 #include "all64.h"
 #include "../include/libpatchfinder/patchfinder64.hpp"
-#include "StableHash.h"
+#include "../include/libpatchfinder/cfg64.hpp"
+#include "../include/libpatchfinder/emu64.hpp"
 
 #include <string.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <optional>
 
 using namespace std;
 using namespace tihmstar;
@@ -27,7 +31,14 @@ using namespace arm64;
 
 patchfinder64::patchfinder64(bool freeBuf) :
     patchfinder(freeBuf),
-    _vmem(nullptr)
+    _vmem(nullptr),
+    _dataRefsLoaded(false),
+    _scanVisitorsRegistered(false),
+    _gadgetsLoaded(false),
+    _freeCodeLoaded(false),
+    _freeDataLoaded(false),
+    _pacDiscsLoaded(false),
+    _sysregAccessesLoaded(false)
 {
     //
 }
@@ -35,13 +46,36 @@ patchfinder64::patchfinder64(bool freeBuf) :
 patchfinder64::patchfinder64(patchfinder64 &&mv) :
     patchfinder(std::move(mv))
 {
-    _unusedNops = std::move(mv._unusedNops);
+    _freeCode = std::move(mv._freeCode);
+    _freeCodeLoaded = mv._freeCodeLoaded;
+    _freeData = std::move(mv._freeData);
+    _freeDataLoaded = mv._freeDataLoaded;
+    _pacDiscs = std::move(mv._pacDiscs);
+    _pacDiscStart = std::move(mv._pacDiscStart);
+    _pacDiscsLoaded = mv._pacDiscsLoaded;
+    _sysregAccesses = std::move(mv._sysregAccesses);
+    _sysregAccessesLoaded = mv._sysregAccessesLoaded;
     _savedPatches = std::move(mv._savedPatches);
+    _dataRefs = std::move(mv._dataRefs);
+    _dataRefsLoaded = mv._dataRefsLoaded;
+    _regTraces = std::move(mv._regTraces);
+    _regTraceLRU = std::move(mv._regTraceLRU);
+    _cfgCache = std::move(mv._cfgCache);
+    _gadgets = std::move(mv._gadgets);
+    _gadgetsLoaded = mv._gadgetsLoaded;
+    _scanVisitorsRegistered = false; //visitors are bound to the old object, they get registered again on the next scan
     _vmem = mv._vmem; mv._vmem = NULL;
 }
 
 patchfinder64::patchfinder64(loc_t base, const char *filename, std::vector<psegment> segments) :
-    patchfinder(true)
+    patchfinder(true),
+    _dataRefsLoaded(false),
+    _scanVisitorsRegistered(false),
+    _gadgetsLoaded(false),
+    _freeCodeLoaded(false),
+    _freeDataLoaded(false),
+    _pacDiscsLoaded(false),
+    _sysregAccessesLoaded(false)
 {
     struct stat fs = {0};
     int fd = 0;
@@ -84,7 +118,14 @@ patchfinder64::patchfinder64(loc_t base, const char *filename, std::vector<psegm
 }
 
 patchfinder64::patchfinder64(loc_t base, const void *buffer, size_t bufSize, bool takeOwnership, std::vector<psegment> segments) :
-    patchfinder(takeOwnership)
+    patchfinder(takeOwnership),
+    _dataRefsLoaded(false),
+    _scanVisitorsRegistered(false),
+    _gadgetsLoaded(false),
+    _freeCodeLoaded(false),
+    _freeDataLoaded(false),
+    _pacDiscsLoaded(false),
+    _sysregAccessesLoaded(false)
 {
     _bufSize = bufSize;
     _buf = (uint8_t*)buffer;
@@ -168,6 +209,42 @@ patchfinder64::loc_t patchfinder64::find_bof_with_sting_ref(const char *str, boo
     return find_bof(ref);
 }
 
+static void regtrace_step(uint64_t *value, insn &insn){
+    switch (insn.type()) {
+        case insn::adrp:
+            value[insn.rd()] = insn.imm();
+            break;
+        case insn::add:
+            value[insn.rd()] = value[insn.rn()] + insn.imm();
+            break;
+        case insn::adr:
+            value[insn.rd()] = insn.imm();
+            break;
+        case insn::ldr:
+            value[insn.rt()] = value[insn.rn()];
+            if (insn.subtype() == insn::st_immediate) {
+                value[insn.rt()] += insn.imm(); // XXX address, not actual value
+            }
+            break;
+        case insn::movz:
+            value[insn.rd()] = insn.imm();
+            break;
+        case insn::movk:
+            value[insn.rd()] |= insn.imm();
+            break;
+        case insn::mov:
+            value[insn.rd()] = value[insn.rm()];
+            break;
+        case insn::orr:
+            if (insn.subtype() == libinsn::arm64::insn::st_general) {
+                value[insn.rd()] = ((insn.rn() == 0x1f) ? /*wzr*/0 : value[insn.rn()]) + insn.imm();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 uint64_t patchfinder64::find_register_value(loc_t where, int reg, loc_t startAddr){
     vmem functop = _vmem->seg(where);
     
@@ -176,54 +253,61 @@ uint64_t patchfinder64::find_register_value(loc_t where, int reg, loc_t startAdd
     }else{
         functop = startAddr;
     }
-    
-    uint64_t value[32] = {0};
-    
-    for (;(loc_t)functop.pc() < where;++functop) {
-        auto insn = functop();
-        switch (functop().type()) {
-            case insn::adrp:
-                value[insn.rd()] = insn.imm();
-                //                printf("0x%016llx: ADRP X%d, 0x%llx\n", (void*)functop.pc(), functop.rd(), functop.imm());
-                break;
-            case insn::add:
-                value[insn.rd()] = value[insn.rn()] + insn.imm();
-                //                printf("0x%016llx: ADD X%d, X%d, 0x%llx\n", (void*)functop.pc(), functop.rd(), functop.rn(), (uint64_t)functop.imm());
-                break;
-            case insn::adr:
-                value[insn.rd()] = insn.imm();
-                //                printf("0x%016llx: ADR X%d, 0x%llx\n", (void*)functop.pc(), functop.rd(), functop.imm());
-                break;
-            case insn::ldr:
-                //                printf("0x%016llx: LDR X%d, [X%d, 0x%llx]\n", (void*)functop.pc(), functop.rt(), functop.rn(), (uint64_t)functop.imm());
-                value[insn.rt()] = value[insn.rn()];
-                if (insn.subtype() == insn::st_immediate) {
-                    value[insn.rt()] += insn.imm(); // XXX address, not actual value
-                }
-                break;
-            case insn::movz:
-                value[insn.rd()] = insn.imm();
-                break;
-            case insn::movk:
-                value[insn.rd()] |= insn.imm();
-                break;
-            case insn::mov:
-                value[insn.rd()] = value[insn.rm()];
-                break;
-            case insn::orr:
-                if (insn.subtype() == libinsn::arm64::insn::st_general) {
-                    value[insn.rd()] = ((insn.rn() == 0x1f) ? /*wzr*/0 : value[insn.rn()]) + insn.imm();
-                }
-                break;
-            default:
-                break;
+    loc_t start = functop.pc();
+    if (where <= start) return 0;
+
+    /*
+        The state at every point only depends on the function start, so keep it around:
+        queries behind what we already traced replay at most kRegTraceStride instructions from the nearest checkpoint,
+        queries past it continue tracing from where the last one stopped.
+     */
+    auto t = _regTraces.find(start);
+    if (t == _regTraces.end()) {
+        if (_regTraces.size() >= kRegTraceMaxFuncs) {
+            //drop the function which wasn't looked at for the longest time
+            _regTraces.erase(_regTraceLRU.back());
+            _regTraceLRU.pop_back();
+        }
+        _regTraceLRU.push_front(start);
+        t = _regTraces.insert({start, {{}, {}, start, 0, _regTraceLRU.begin()}}).first;
+    } else {
+        _regTraceLRU.splice(_regTraceLRU.begin(), _regTraceLRU, t->second.lru);
+    }
+    regtrace &trace = t->second;
+
+    if (where == trace.curPC) return trace.cur[reg];
+    if (where < trace.curPC) {
+        auto cp = std::upper_bound(trace.checkpoints.begin(), trace.checkpoints.end(), where, [](loc_t where, const std::pair<loc_t, std::array<uint64_t, 32>> &c){
+            return where < c.first;
+        });
+        assure(cp != trace.checkpoints.begin());
+        --cp;
+        std::array<uint64_t, 32> value = cp->second;
+        for (functop = cp->first; (loc_t)functop.pc() < where; ++functop) {
+            auto isn = functop();
+            regtrace_step(value.data(), isn);
         }
+        return value[reg];
     }
-    return value[reg];
+
+    for (functop = trace.curPC; (loc_t)functop.pc() < where;) {
+        if (trace.insnCnt % kRegTraceStride == 0) trace.checkpoints.push_back({trace.curPC, trace.cur});
+        auto isn = functop();
+        ++functop;
+        regtrace_step(trace.cur.data(), isn);
+        trace.insnCnt++;
+        trace.curPC = functop.pc();
+    }
+    return trace.cur[reg];
 }
 
 patchfinder64::loc_t patchfinder64::find_literal_ref(loc_t pos, int ignoreTimes, loc_t startPos){
-    auto adrp = _vmem->getIter(startPos);
+    return find_literal_ref_in_vmem(_vmem, pos, ignoreTimes, startPos);
+}
+
+patchfinder64::loc_t patchfinder64::find_literal_ref_in_vmem(const vmem *mem, loc_t pos, int ignoreTimes, loc_t startPos){
+    auto adrp = mem->getIter(startPos);
+    std::optional<emu64> emu;
     
     try {
         for (;;++adrp){
@@ -243,7 +327,7 @@ patchfinder64::loc_t patchfinder64::find_literal_ref(loc_t pos, int ignoreTimes,
                 rd = adrp().rd();
                 imm = adrp().imm();
                 
-                vmem iter = _vmem->getIter(adrp);
+                vmem iter = mem->getIter(adrp);
                 
                 for (int i=0; i<10; i++) {
                     auto isn = ++iter;
@@ -284,30 +368,26 @@ patchfinder64::loc_t patchfinder64::find_literal_ref(loc_t pos, int ignoreTimes,
                     return (loc_t)adrp.pc();
                 }
                 
-                vmem iter = _vmem->getIter(adrp);
-                                
-                for (int i=0; i<10; i++) {
-                    ++iter;
-                retry:
-                    if (iter() == insn::movk && rd == iter().rd()){
-                        imm |= iter().imm();
-                        if (imm == (int64_t)pos){
-                            if (ignoreTimes) {
-                                ignoreTimes--;
-                                break;
-                            }
-                            return (loc_t)iter.pc();
-                        }
-                    }else if (iter() == insn::movz && rd == iter().rd()){
-                        break;
-                    } else if (iter() == insn::b){
-                        if (iter.pc() == iter().imm()) break; //found b .
-                        try {
-                            iter = iter().imm(); //this can go out of memory and fail, ignore failure
-                        } catch (...) {
+                //let the emulator follow the movk chain (and any unconditional branches in between)
+                if (!emu) emu.emplace(emulator(mem, adrp.pc()));
+                else emu->reset(adrp.pc());
+                emu->step(); //movz
+                for (int i=0; i<10 && emu->executed() < 0x20 && emu->step(); i++) {
+                    insn isn(emu->lastOpcode(), emu->lastPC());
+                    if (isn == insn::b){
+                        if (isn.imm() == isn.pc()) break; //found b .
+                        i--; //branches don't count
+                        continue;
+                    }
+                    if (!emu->isKnown(rd)) break;
+                    if (isn == insn::movz && rd == isn.rd()) break;
+                    if (isn != insn::movk || rd != isn.rd()) continue;
+                    if (emu->reg(rd) == pos){
+                        if (ignoreTimes) {
+                            ignoreTimes--;
                             break;
                         }
-                        goto retry;
+                        return (loc_t)isn.pc();
                     }
                 }
             }
@@ -399,61 +479,17 @@ patchfinder64::loc_t patchfinder64::find_block_branch_ref(loc_t pos, int limit,
 
 patchfinder64::loc_t patchfinder64::findnops(uint16_t nopCnt, bool useNops, uint32_t nopOpcode){
     size_t tgtSize = nopCnt*4;
-    if (!_unusedNops.size()) {
-        vmem exec_mem = _vmem->getIter();
-        
-        bool isrunning = false;
-        loc_t start = 0;
-        
-        try {
-            while (true) {
-                uint32_t op = (++exec_mem).opcode();
-                if (op == nopOpcode || op == 0) {
-                    if (!isrunning) {
-                        isrunning = true;
-                        start = exec_mem.pc();
-                    }
-                }else{
-                    if (isrunning) {
-                        isrunning = false;
-                        size_t nps = exec_mem.pc()-start;
-                        if (nps < 4*11) continue; //have a minimum of 10 free nops
-                        _unusedNops.push_back({start,nps});
-                    }
-                }
-            }
-        } catch (...) {
-            //
-        }
-        _unusedNops.push_back({0,0}); //mark as inited
-    }
-    retassure(_unusedNops.size(), "Failed to find nopspace");
-    
-    int besti = -1;
-    size_t bestSize = 0;
-    
-    for (int i=0; i<_unusedNops.size(); i++) {
-        auto np = _unusedNops.at(i);
-        if (tgtSize <= np.second) {
-            if (besti == -1 || np.second < bestSize) {
-                besti = i;
-                bestSize = np.second;
-            }
-        }
+    if (!_freeCodeLoaded) {
+        loadFreeCode(nopOpcode);
+        debug("found %zu nop runs (0x%zx bytes)",_freeCode.extents(),_freeCode.bytes());
+        _freeCodeLoaded = true;
     }
-    retassure(besti != -1, "Failed to find enough nopspace");
-    auto foundnops = _unusedNops.at(besti);
+    loc_t ret = useNops ? _freeCode.alloc(tgtSize) : _freeCode.find(tgtSize);
+    retassure(ret, "Failed to find enough nopspace");
     if (useNops) {
-        _unusedNops.erase(_unusedNops.begin() + besti);
-        size_t remainSpaceSize = 0;
-        if (tgtSize < bestSize) {
-            remainSpaceSize = foundnops.second - tgtSize;
-            loc_t remainSpace = foundnops.first + tgtSize;
-            _unusedNops.push_back({remainSpace,remainSpaceSize});
-        }
-        debug("consuming nops {0x%016llx,0x%016llx}",foundnops.first,foundnops.first+foundnops.second-remainSpaceSize);
+        debug("consuming nops {0x%016llx,0x%016llx}",ret,ret+tgtSize);
     }
-    return foundnops.first;
+    return ret;
 }
 
 patchfinder64::loc_t patchfinder64::memmem(const void *little, size_t little_len, patchfinder::loc_t startLoc) const {
@@ -469,6 +505,209 @@ patchfinder64::loc_t patchfinder64::deref(patchfinder::loc_t pos) const {
 }
 
 #pragma mark own functions
+void patchfinder64::addDataRefsForSegment(const vsegment &seg){
+    size_t skip = (8 - (seg.vaddr & 7)) & 7;
+    for (size_t i = skip; i+8 <= seg.size; i+=8) {
+        uint64_t val = *(const uint64_t*)&seg.buf[i];
+        if (!val || !_vmem->isInRange(val)) continue;
+        _dataRefs.push_back({val,seg.vaddr+i});
+    }
+}
+
+void patchfinder64::loadDataRefs(){
+    std::vector<vsegment> segments = _vmem->getSegments();
+    bool haveData = false;
+    for (auto &seg : segments) {
+        if (seg.perms & kVMPROTEXEC) continue;
+        addDataRefsForSegment(seg);
+        haveData = true;
+    }
+    if (!haveData) {
+        //e.g. iBoot is just one big rwx blob
+        for (auto &seg : segments) addDataRefsForSegment(seg);
+    }
+}
+
+void patchfinder64::indexDataRefs(){
+    if (_dataRefsLoaded) return;
+    loadDataRefs();
+    std::sort(_dataRefs.begin(), _dataRefs.end());
+    debug("indexed %zu data pointers",_dataRefs.size());
+    _dataRefsLoaded = true;
+}
+
+std::vector<patchfinder64::loc_t> patchfinder64::find_data_refs(loc_t ptr){
+    indexDataRefs();
+    std::vector<loc_t> ret;
+    auto e = std::lower_bound(_dataRefs.begin(), _dataRefs.end(), std::pair<uint64_t, loc_t>{ptr,0});
+    for (; e != _dataRefs.end() && e->first == ptr; e++) {
+        ret.push_back(e->second);
+    }
+    return ret;
+}
+
+patchfinder64::loc_t patchfinder64::find_data_ref(loc_t ptr, int ignoreTimes){
+    auto refs = find_data_refs(ptr);
+    retassure(refs.size() > (size_t)ignoreTimes, "Failed to find data ref to 0x%016llx",ptr);
+    return refs.at(ignoreTimes);
+}
+
+patchfinder64::loc_t patchfinder64::find_next_bof(loc_t bof, size_t limit){
+    try {
+        vmem iter = _vmem->getIter(bof);
+        while ((++iter).pc() < bof + limit) {
+            if (iter() == insn::pacibsp) return iter;
+            if (iter() == insn::stp && iter().rt2() == 30 && iter().rn() == 31) {
+                //the stp of our own prologue leads back to bof
+                loc_t next = find_bof(iter);
+                if (next > bof) return next;
+            }
+        }
+    } catch (tihmstar::exception &e) {
+        //ran out of executable memory
+    }
+    return bof + limit;
+}
+
+std::shared_ptr<const cfg64> patchfinder64::cfg_for_function(loc_t pos){
+    loc_t bof = find_bof(pos);
+    for (auto it = _cfgCache.begin(); it != _cfgCache.end(); it++) {
+        if ((*it)->funcStart() == bof) {
+            _cfgCache.splice(_cfgCache.begin(), _cfgCache, it);
+            return _cfgCache.front();
+        }
+    }
+    auto ret = std::make_shared<const cfg64>(_vmem, bof, find_next_bof(bof, cfg64::kMaxFuncSize));
+    _cfgCache.push_front(ret);
+    if (_cfgCache.size() > kCFGCacheSize) _cfgCache.pop_back();
+    return ret;
+}
+
+uint64_t patchfinder64::emulate_register_value(loc_t start, loc_t where, uint8_t reg, uint32_t budget){
+    return emulator(_vmem, start).value_at(where, reg, budget);
+}
+
+#pragma mark free space
+/*
+    Whole blocks are checked first with a branchless loop the compiler can vectorize,
+    only blocks where a run starts or ends are walked word by word.
+ */
+static constexpr size_t kFreeScanBlock = 16;
+
+static bool freeScanBlockIs(const uint32_t *words, uint32_t nopOpcode, bool isFree){
+    uint32_t hits = 0;
+    for (size_t i=0; i<kFreeScanBlock; i++) {
+        hits += (words[i] == nopOpcode) | (words[i] == 0);
+    }
+    return hits == (isFree ? kFreeScanBlock : 0);
+}
+
+static void addFreeRuns(freespace &fs, const vsegment &seg, uint32_t nopOpcode, size_t minRun){
+    size_t skip = (4 - (seg.vaddr & 3)) & 3;
+    if (seg.size <= skip) return;
+    const uint32_t *words = (const uint32_t*)&seg.buf[skip];
+    size_t cnt = (seg.size - skip)/4;
+    patchfinder64::loc_t base = seg.vaddr + skip;
+
+    size_t runStart = 0;
+    bool inRun = false;
+    size_t i = 0;
+    while (i < cnt) {
+        if (i + kFreeScanBlock <= cnt && freeScanBlockIs(&words[i], nopOpcode, inRun)) {
+            i += kFreeScanBlock;
+            continue;
+        }
+        bool isFree = words[i] == nopOpcode || words[i] == 0;
+        if (isFree && !inRun) {
+            runStart = i;
+            inRun = true;
+        } else if (!isFree && inRun) {
+            if (i - runStart >= minRun) fs.add(base + runStart*4, (i - runStart)*4);
+            inRun = false;
+        }
+        i++;
+    }
+    //leave out the last word, so this doesn't get merged with a run at the start of a directly following segment
+    if (inRun && cnt - 1 - runStart >= minRun) fs.add(base + runStart*4, (cnt - 1 - runStart)*4);
+}
+
+void patchfinder64::loadFreeCode(uint32_t nopOpcode){
+    for (auto &seg : _vmem->getSegments()) {
+        if (!(seg.perms & kVMPROTEXEC)) continue;
+        addFreeRuns(_freeCode, seg, nopOpcode, kMinNopRun);
+    }
+}
+
+void patchfinder64::loadFreeData(){
+    //
+}
+
+patchfinder64::loc_t patchfinder64::find_free_data(size_t size, bool use){
+    if (!_freeDataLoaded) {
+        loadFreeData();
+        debug("found %zu free data ranges (0x%zx bytes)",_freeData.extents(),_freeData.bytes());
+        _freeDataLoaded = true;
+    }
+    loc_t ret = use ? _freeData.alloc(size) : _freeData.find(size);
+    retassure(ret, "Failed to find 0x%zx bytes of free data space",size);
+    if (use) {
+        debug("consuming data space {0x%016llx,0x%016llx}",ret,ret+size);
+    }
+    return ret;
+}
+
+#pragma mark shared scan
+void patchfinder64::registerScanVisitors(){
+    if (!_gadgetsLoaded) subscribe_scan("gadgets", gadgetScanVisitor());
+    if (!_pacDiscsLoaded) subscribe_scan("pacdiscs", pacDiscScanVisitor());
+    if (!_sysregAccessesLoaded) subscribe_scan("sysregs", sysregScanVisitor());
+}
+
+void patchfinder64::subscribe_scan(std::string name, scanvisitor visitor){
+    _scanVisitors[name] = visitor;
+}
+
+void patchfinder64::run_scan(){
+    if (!_scanVisitorsRegistered) {
+        registerScanVisitors();
+        _scanVisitorsRegistered = true;
+    }
+    if (!_scanVisitors.size()) return;
+    std::vector<scanvisitor> pending;
+    for (auto &v : _scanVisitors) {
+        pending.push_back(v.second);
+    }
+    debug("running shared scan for %zu visitors",pending.size());
+    _scanVisitors.clear();
+
+    vmem iter = _vmem->getIter();
+    try {
+        while (pending.size()) {
+            insn isn = iter();
+            for (auto v = pending.begin(); v != pending.end();) {
+                bool done = false;
+                try {
+                    done = v->visit(isn, iter);
+                } catch (tihmstar::exception &e) {
+                    //e.g. looking ahead past the end, doesn't concern the other visitors
+                }
+                if (done) {
+                    if (v->finish) v->finish();
+                    v = pending.erase(v);
+                } else {
+                    v++;
+                }
+            }
+            ++iter;
+        }
+    } catch (tihmstar::out_of_range &e) {
+        //reached the end
+    }
+    for (auto &v : pending) {
+        if (v.finish) v.finish();
+    }
+}
+
 uint32_t patchfinder64::pageshit_for_pagesize(uint32_t pagesize){
     uint32_t pageshift = 0;
     while (pagesize>>=1) pageshift++;
@@ -569,16 +808,217 @@ uint64_t patchfinder64::pte_index_to_vma(uint32_t pagesize, uint8_t level, uint6
     }
 }
 
+#pragma mark gadgets
+patchfinder64::scanvisitor patchfinder64::gadgetScanVisitor(){
+    return {
+        [this](insn &isn, vmem &iter)->bool{
+            uint32_t op = isn.opcode();
+            if ((op & 0xfe000000) != 0xd6000000) return false; //ret, br, blr and their pac variants
+            gadget g{isn.pc(), {op}, 1};
+            try {
+                for (; g.cnt < kGadgetMaxInsns; g.cnt++) {
+                    insn prev = iter - g.cnt;
+                    if (prev.pc() != g.end - 4*g.cnt) break; //crossed into another segment
+                    uint32_t prevop = prev.opcode();
+                    if ((prevop & 0xfe000000) == 0xd6000000 || (prevop & 0xfc000000) == 0x14000000) break; //can't fall through from there
+                    g.ops[g.cnt] = prevop;
+                }
+            } catch (tihmstar::exception &e) {
+                //start of memory
+            }
+            _gadgets.push_back(g);
+            return false;
+        },
+        [this]{
+            std::sort(_gadgets.begin(), _gadgets.end(), [](const gadget &a, const gadget &b){
+                for (int i=0; i<kGadgetMaxInsns; i++) {
+                    if (a.ops[i] != b.ops[i]) return a.ops[i] < b.ops[i];
+                }
+                return a.end < b.end;
+            });
+            debug("indexed %zu gadgets",_gadgets.size());
+            _gadgetsLoaded = true;
+        }
+    };
+}
+
+void patchfinder64::loadGadgets(){
+    if (_gadgetsLoaded) return;
+    subscribe_scan("gadgets", gadgetScanVisitor());
+    run_scan();
+}
+
+std::vector<patchfinder64::loc_t> patchfinder64::find_gadgets(const std::vector<uint32_t> &opcodes){
+    retassure(opcodes.size() && opcodes.size() <= kGadgetMaxInsns, "gadgets are 1 to %d instructions",kGadgetMaxInsns);
+    loadGadgets();
+    uint8_t cnt = (uint8_t)opcodes.size();
+    gadget key{0, {}, cnt};
+    for (int i=0; i<cnt; i++) key.ops[i] = opcodes[cnt-1-i];
+    auto range = std::equal_range(_gadgets.begin(), _gadgets.end(), key, [cnt](const gadget &a, const gadget &b){
+        for (int i=0; i<cnt; i++) {
+            if (a.ops[i] != b.ops[i]) return a.ops[i] < b.ops[i];
+        }
+        return false;
+    });
+    std::vector<loc_t> ret;
+    for (auto g = range.first; g != range.second; g++) {
+        if (g->cnt >= cnt) ret.push_back(g->end - 4*(cnt-1));
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+patchfinder64::loc_t patchfinder64::find_gadget(const std::vector<uint32_t> &opcodes, int ignoreTimes){
+    auto gadgets = find_gadgets(opcodes);
+    retassure(gadgets.size() > (size_t)ignoreTimes, "Failed to find gadget");
+    return gadgets.at(ignoreTimes);
+}
+
+patchfinder64::loc_t patchfinder64::find_gadget_ret_const(uint16_t n){
+    constexpr uint32_t ret = 0xd65f03c0; //plain ret, retab would need a signed lr
+    std::vector<uint32_t> movs = {
+        0xd2800000 | ((uint32_t)n << 5), //movz x0, #n
+        0x52800000 | ((uint32_t)n << 5), //movz w0, #n
+    };
+    if (!n) {
+        movs.push_back(0xaa1f03e0); //mov x0, xzr
+        movs.push_back(0x2a1f03e0); //mov w0, wzr
+    }
+    loc_t best = 0;
+    for (uint32_t mov : movs) {
+        auto gadgets = find_gadgets({mov, ret});
+        if (gadgets.size() && (!best || gadgets.front() < best)) best = gadgets.front();
+    }
+    retassure(best, "Failed to find 'return %d' gadget",n);
+    return best;
+}
+
+#pragma mark pointer auth
+patchfinder64::scanvisitor patchfinder64::pacDiscScanVisitor(){
+    return {
+        [this](insn &isn, vmem &iter)->bool{
+            uint32_t op = isn.opcode();
+            if ((op & 0xffe00000) != 0xf2e00000) return false; //movk xN, #imm, lsl #48
+            pacdisc d{isn.pc(), 0, (uint16_t)((op >> 5) & 0xffff), (uint8_t)(op & 0x1f), 0};
+            try {
+                for (int i=1; i<=kPACUseWindow; i++) {
+                    insn next = iter + i;
+                    if (next.pc() != d.movk + 4*i) break; //crossed into another segment
+                    uint32_t nop = next.opcode();
+                    if ((nop & 0xffffe000) == 0xdac10000 && ((nop >> 5) & 0x1f) == d.modReg) {
+                        //pacia, pacib, pacda, pacdb, autia, autib, autda, autdb
+                        d.use = next.pc();
+                        d.ptrReg = nop & 0x1f;
+                        break;
+                    }
+                    if ((nop & 0xfedff800) == 0xd61f0800 && (nop & 0x1f) == d.modReg) {
+                        //braa, brab, blraa, blrab
+                        d.use = next.pc();
+                        d.ptrReg = (nop >> 5) & 0x1f;
+                        break;
+                    }
+                    if ((nop & 0xfe000000) == 0xd6000000 || (nop & 0xfc000000) == 0x14000000) break; //doesn't fall through
+                }
+            } catch (tihmstar::exception &e) {
+                //end of memory
+            }
+            _pacDiscs.push_back(d);
+            return false;
+        },
+        [this]{
+            std::sort(_pacDiscs.begin(), _pacDiscs.end(), [](const pacdisc &a, const pacdisc &b){
+                if (a.disc != b.disc) return a.disc < b.disc;
+                return a.movk < b.movk;
+            });
+            _pacDiscStart.assign(0x10001, 0);
+            for (auto &d : _pacDiscs) _pacDiscStart[d.disc+1]++;
+            for (uint32_t i=1; i<_pacDiscStart.size(); i++) _pacDiscStart[i] += _pacDiscStart[i-1];
+            debug("indexed %zu pointer auth discriminators",_pacDiscs.size());
+            _pacDiscsLoaded = true;
+        }
+    };
+}
+
+void patchfinder64::loadPACDiscs(){
+    if (_pacDiscsLoaded) return;
+    subscribe_scan("pacdiscs", pacDiscScanVisitor());
+    run_scan();
+}
+
+std::pair<const patchfinder64::pacdisc *, const patchfinder64::pacdisc *> patchfinder64::pac_discs(uint16_t disc){
+    loadPACDiscs();
+    retassure(_pacDiscsLoaded, "Failed to index pointer auth discriminators");
+    return {_pacDiscs.data() + _pacDiscStart[disc], _pacDiscs.data() + _pacDiscStart[disc+1]};
+}
+
+patchfinder64::loc_t patchfinder64::find_pac_disc_ref(uint16_t disc, int ignoreTimes, loc_t startPos){
+    auto discs = pac_discs(disc);
+    auto d = std::upper_bound(discs.first, discs.second, startPos, [](loc_t pos, const pacdisc &d){
+        return pos < d.movk;
+    });
+    retassure(discs.second - d > ignoreTimes, "Failed to find movk of pac discriminator 0x%04x",disc);
+    return d[ignoreTimes].movk;
+}
+
+#pragma mark system registers
+patchfinder64::scanvisitor patchfinder64::sysregScanVisitor(){
+    return {
+        [this](insn &isn, vmem &)->bool{
+            uint32_t op = isn.opcode();
+            if ((op & 0xffd00000) != 0xd5100000) return false; //mrs, msr (register)
+            _sysregAccesses.push_back({isn.pc(), (insn::systemreg)((op >> 5) & 0x7fff), (uint8_t)(op & 0x1f), !(op & (1 << 21))});
+            return false;
+        },
+        [this]{
+            std::sort(_sysregAccesses.begin(), _sysregAccesses.end(), [](const sysregaccess &a, const sysregaccess &b){
+                if (a.sysreg != b.sysreg) return a.sysreg < b.sysreg;
+                return a.pc < b.pc;
+            });
+            debug("indexed %zu system register accesses",_sysregAccesses.size());
+            _sysregAccessesLoaded = true;
+        }
+    };
+}
+
+void patchfinder64::loadSysregAccesses(){
+    if (_sysregAccessesLoaded) return;
+    subscribe_scan("sysregs", sysregScanVisitor());
+    run_scan();
+}
+
+std::pair<const patchfinder64::sysregaccess *, const patchfinder64::sysregaccess *> patchfinder64::sysreg_accesses(insn::systemreg sysreg){
+    loadSysregAccesses();
+    retassure(_sysregAccessesLoaded, "Failed to index system register accesses");
+    auto first = std::lower_bound(_sysregAccesses.begin(), _sysregAccesses.end(), sysreg, [](const sysregaccess &a, insn::systemreg reg){
+        return a.sysreg < reg;
+    });
+    auto last = std::upper_bound(first, _sysregAccesses.end(), sysreg, [](insn::systemreg reg, const sysregaccess &a){
+        return reg < a.sysreg;
+    });
+    return {_sysregAccesses.data() + (first - _sysregAccesses.begin()), _sysregAccesses.data() + (last - _sysregAccesses.begin())};
+}
+
+patchfinder64::loc_t patchfinder64::find_sysreg_access(insn::systemreg sysreg, bool isMSR, int ignoreTimes, loc_t startPos){
+    auto accesses = sysreg_accesses(sysreg);
+    auto a = std::upper_bound(accesses.first, accesses.second, startPos, [](loc_t pos, const sysregaccess &a){
+        return pos < a.pc;
+    });
+    for (; a != accesses.second; a++) {
+        if (a->isMSR == isMSR && ignoreTimes-- == 0) return a->pc;
+    }
+    reterror("Failed to find %s of sysreg 0x%04llx",isMSR ? "msr" : "mrs",(uint64_t)sysreg);
+}
+
+#pragma mark emulation
+emu64 patchfinder64::emulator(const vmem *mem, loc_t pc){
+    return emu64(mem, pc);
+}
+
 #pragma mark own functions virtual
 uint16_t patchfinder64::getPointerAuthStringDiscriminator(const char *strDesc){
-    return clang::getPointerAuthStringDiscriminator(strDesc);
+    return ptrauth::string_discriminator(strDesc);
 }
 
 patchfinder64::loc_t patchfinder64::find_PACedPtrRefWithStrDesc(const char *strDesc, int ignoreTimes, loc_t startPos){
-    uint64_t desc = getPointerAuthStringDiscriminator(strDesc);
-    vmem iter = _vmem->getIter(startPos);
-    while (true) {
-        while (++iter != insn::movk || iter().imm() != ((uint64_t)desc << 48));
-        if (ignoreTimes-- == 0) return iter;
-    }
+    return find_pac_disc_ref(getPointerAuthStringDiscriminator(strDesc), ignoreTimes, startPos);
 }
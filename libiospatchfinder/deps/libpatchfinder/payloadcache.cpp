@@ -0,0 +1,229 @@
+//
+//  payloadcache.cpp
+//  libpatchfinder
+//
+//  Created by tihmstar on 19.10.26.
+//
+
+#include "../include/libpatchfinder/payloadcache.hpp"
+#include <libgeneral/macros.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+
+using namespace tihmstar::patchfinder;
+
+#define PAYLOADCACHE_SUFFIX ".macho"
+
+#pragma mark helper
+
+/*
+    XXH64, fast enough to not matter next to decompression
+ */
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t v, int r){
+    return (v << r) | (v >> (64-r));
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input){
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val){
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static uint64_t xxh64(const void *buf, size_t size, uint64_t seed){
+    const uint8_t *p = (const uint8_t*)buf;
+    const uint8_t *end = p + size;
+    uint64_t h = 0;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + XXH_P1 + XXH_P2;
+        uint64_t v2 = seed + XXH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_P1;
+        for (; p + 32 <= end; p += 32) {
+            uint64_t w[4];
+            memcpy(w, p, sizeof(w));
+            v1 = xxh64_round(v1, w[0]);
+            v2 = xxh64_round(v2, w[1]);
+            v3 = xxh64_round(v3, w[2]);
+            v4 = xxh64_round(v4, w[3]);
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }else{
+        h = seed + XXH_P5;
+    }
+    h += size;
+
+    for (; p + 8 <= end; p += 8) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+        h ^= xxh64_round(0, k);
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (p + 4 <= end) {
+        uint32_t k;
+        memcpy(&k, p, sizeof(k));
+        h ^= (uint64_t)k * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+#pragma mark payloadcache
+
+payloadcache::payloadcache(const char *dir, uint64_t maxSize)
+: _dir(dir ? dir : ""), _maxSize(maxSize)
+{
+    if (!_maxSize) {
+        const char *envMaxSize = getenv(PAYLOADCACHE_MAXSIZE_ENV);
+        if (envMaxSize) _maxSize = strtoull(envMaxSize, NULL, 0);
+        if (!_maxSize) _maxSize = PAYLOADCACHE_DEFAULT_MAXSIZE;
+    }
+    if (_dir.size()) {
+        mkdir(_dir.c_str(), 0755); //may already exist
+    }
+}
+
+std::string payloadcache::pathForKey(const std::string &key) const{
+    return _dir + "/" + key + PAYLOADCACHE_SUFFIX;
+}
+
+bool payloadcache::isEnabled() const{
+    return _dir.size();
+}
+
+const void *payloadcache::map(const std::string &key, size_t *outSize) const noexcept{
+    int fd = -1;
+    void *mem = MAP_FAILED;
+    cleanup([&]{
+        if (fd > 0) close(fd);
+    });
+    struct stat st = {};
+    if (!isEnabled()) return NULL;
+
+    std::string path = pathForKey(key);
+    if ((fd = open(path.c_str(), O_RDONLY)) == -1) return NULL;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(uint32_t)) return NULL;
+
+    //private mapping, so patching the buffer in memory never touches the cache
+    if ((mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) return NULL;
+
+    //refresh timestamp, this is what eviction goes by
+    futimes(fd, NULL);
+    info("Using cached payload %s",path.c_str());
+    *outSize = st.st_size;
+    return mem;
+}
+
+void payloadcache::store(const std::string &key, const void *buf, size_t size) const noexcept{
+    std::string tmpPath;
+    int fd = -1;
+    cleanup([&]{
+        if (fd > 0) close(fd);
+        if (tmpPath.size()) unlink(tmpPath.c_str());
+    });
+    if (!isEnabled()) return;
+
+    try {
+        //write next to the final location, then rename. Concurrent readers either see the full file or nothing
+        tmpPath = _dir + "/." + key + ".XXXXXX";
+        retassure((fd = mkstemp((char*)tmpPath.data())) != -1, "Failed to create tempfile in cache dir '%s'",_dir.c_str());
+        fchmod(fd, 0644);
+        for (size_t didWrite = 0; didWrite < size;) {
+            ssize_t w = write(fd, (const uint8_t*)buf+didWrite, size-didWrite);
+            retassure(w > 0, "Failed to write cache entry");
+            didWrite += w;
+        }
+        retassure(!fsync(fd), "Failed to sync cache entry");
+        close(fd); fd = -1;
+        retassure(!rename(tmpPath.c_str(), pathForKey(key).c_str()), "Failed to move cache entry into place");
+        tmpPath.clear();
+        evict(key);
+    } catch (tihmstar::exception &e) {
+        warning("Failed to store payload in cache with error:\n%s",e.dumpStr().c_str());
+    }
+}
+
+void payloadcache::evict(const std::string &keep) const{
+    struct cacheentry{
+        std::string name;
+        uint64_t size;
+        time_t mtime;
+    };
+    std::vector<cacheentry> entries;
+    uint64_t totalSize = 0;
+    DIR *dir = NULL;
+    cleanup([&]{
+        safeFreeCustom(dir, closedir);
+    });
+    if (!isEnabled()) return;
+
+    retassure(dir = opendir(_dir.c_str()), "Failed to open cache dir '%s'",_dir.c_str());
+    while (struct dirent *ent = readdir(dir)) {
+        struct stat st = {};
+        size_t nameLen = strlen(ent->d_name);
+        if (ent->d_name[0] == '.') continue; //skips tempfiles too
+        if (nameLen <= sizeof(PAYLOADCACHE_SUFFIX)-1 || strcmp(&ent->d_name[nameLen-(sizeof(PAYLOADCACHE_SUFFIX)-1)], PAYLOADCACHE_SUFFIX)) continue;
+        if (fstatat(dirfd(dir), ent->d_name, &st, 0)) continue;
+        entries.push_back({ent->d_name, (uint64_t)st.st_size, st.st_mtime});
+        totalSize += st.st_size;
+    }
+    if (totalSize <= _maxSize) return;
+
+    std::sort(entries.begin(), entries.end(), [](const cacheentry &a, const cacheentry &b){
+        return a.mtime < b.mtime;
+    });
+    for (auto &e : entries) {
+        if (totalSize <= _maxSize) break;
+        if (e.name == keep + PAYLOADCACHE_SUFFIX) continue;
+        //another worker may have beaten us to it, existing mappings stay valid either way
+        if (!unlinkat(dirfd(dir), e.name.c_str(), 0) || errno == ENOENT) {
+            debug("Evicted cache entry %s",e.name.c_str());
+            totalSize -= e.size;
+        }
+    }
+}
+
+#pragma mark static
+std::string payloadcache::keyForBuffer(const void *buf, size_t size){
+    char key[2*16+1+16+1] = {};
+    snprintf(key, sizeof(key), "%016llx%016llx-%llx",
+             (unsigned long long)xxh64(buf, size, 0), (unsigned long long)xxh64(buf, size, XXH_P1),
+             (unsigned long long)size);
+    return key;
+}